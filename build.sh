@@ -1,3 +1,4 @@
 mkdir -p bin
-gcc -DZ64VIEWER_WANT_MAIN src/*.c -o bin/z64viewer -I include -lm -lglfw -ldl
+gcc -DZ64VIEWER_WANT_MAIN src/*.c -o bin/z64viewer -I include -lm -lglfw -ldl -pthread
+gcc -DN64_BACKEND_DEFAULT=n64_backend_null tools/z64dlstat.c src/n64.c src/n64bake.c src/n64cmd.c src/n64sort.c src/n64backend_null.c src/n64texconv.c src/bigendian.c src/rcp.c -o bin/z64dlstat -I include -lm -pthread -O2
 
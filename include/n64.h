@@ -17,6 +17,7 @@
 #undef bool
 typedef _Bool bool;
 
+/* textures made ahead of each flush; the cache grows past it */
 #ifndef N64_TEXTURE_CACHE_SIZE
 	#define N64_TEXTURE_CACHE_SIZE 512
 #endif
@@ -29,6 +30,26 @@ typedef _Bool bool;
 	#define N64_XLU_STACK_SIZE 4096
 #endif
 
+#ifndef N64_DLCACHE_BUCKETS
+	#define N64_DLCACHE_BUCKETS 1024
+#endif
+
+#ifndef N64_DLCACHE_MAX
+	#define N64_DLCACHE_MAX 16384
+#endif
+
+#ifndef N64_VTXCACHE_BUCKETS
+	#define N64_VTXCACHE_BUCKETS 1024
+#endif
+
+#ifndef N64_VTXCACHE_MAX
+	#define N64_VTXCACHE_MAX 4096
+#endif
+
+#ifndef N64_DL_STACK_SIZE
+	#define N64_DL_STACK_SIZE 32
+#endif
+
 #ifndef N64_MTX_STACK_SIZE
 	#define N64_MTX_STACK_SIZE 16
 #endif
@@ -90,9 +111,50 @@ typedef struct {
 	uint32_t setId;
 } N64Tri;
 
+/* every triangle of a batch at once, three vertices per triangle in
+ * order; positions are split into one array per axis */
+typedef struct {
+	const float* x;
+	const float* y;
+	const float* z;
+	uint32_t num; /* triangles, so each array holds num * 3 floats */
+	struct {
+		bool cullBackface  : 1;
+		bool cullFrontface : 1;
+	};
+	uint32_t setId;
+} N64TriBatch;
+
+/* gathered by the display list interpreter while n64_stats(true) */
+typedef struct {
+	struct {
+		uint64_t count;
+		uint64_t cycles;
+	} op[256];
+	uint64_t mtlCount;    /* do_mtl() calls (material/texture setup) */
+	uint64_t mtlCycles;
+	uint64_t dlists;      /* display lists entered, including nested ones */
+	uint32_t maxDepth;    /* deepest G_DL nesting */
+	uint32_t maxMtxDepth; /* deepest G_MTX push */
+	uint64_t vertices;    /* loaded by G_VTX */
+	uint32_t palettes;    /* distinct G_LOADTLUT sources */
+	uint64_t vtxHits;     /* G_VTX loads found in n64_vertex_cache() */
+	uint64_t vtxMisses;
+	uint64_t stateCalls;  /* render state changes requested */
+	uint64_t stateElided; /* ...that the backend already had */
+	uint64_t cullAccepted; /* G_CULLDL lists that were drawn */
+	uint64_t cullRejected; /* ...and the ones that were skipped */
+	uint32_t textures;          /* converted and uploaded */
+	uint32_t texturesShared;    /* ...or found identical to one that was */
+	uint64_t textureBytesSaved; /* rgba8888 those would have taken */
+} N64Stats;
+
 typedef bool (*N64CullCallback)(void* u_data, const N64Vtx*, uint32_t num);
 typedef void (*N64TriCallback)(void* u_data, const N64Tri*);
+typedef void (*N64TriBatchCallback)(void* u_data, const N64TriBatch*);
 typedef struct N64Object N64Object;
+typedef struct N64Trace N64Trace;
+typedef struct N64Bake N64Bake;
 
 void n64_register_skeleton(uint16_t obj_id, uint8_t uniq_id, const void* obj, uint8_t seg_id, uint32_t skel_offset);
 void n64_register_dlist(uint16_t obj_id, uint8_t uniq_id, const void* obj, uint8_t seg_id, GbiGfx* dlist, int dlist_num);
@@ -106,6 +168,7 @@ void n64_object_draw(N64Object*);
 void n64_object_set_mtx(N64Object*, const void* mtx);
 
 void n64_segment_set(int seg, void* data);
+void n64_segment_set_sized(int seg, void* data, uint32_t size);
 void* n64_segment_get(unsigned int segaddr);
 unsigned int n64_segment_ptr_offset(void* cmd);
 
@@ -120,12 +183,26 @@ void n64_mtx_projection(void*);
 
 void* n64_graph_alloc(uint32_t);
 void n64_clear_cache(void);
+bool n64_dlist_cache(bool state);
+bool n64_vertex_cache(bool state);
 
 void n64_draw_dlist(void* dlist);
 void n64_update_tick(void);
 void n64_buffer_init(void);
 void n64_buffer_flush(bool drawDecalsSeparately);
 void n64_buffer_clear(void);
+bool n64_buffer_threads(bool state);
+bool n64_buffer_sort(bool state);
+
+N64Bake* n64_bake_dlist(void* dlist);
+void n64_bake_draw(const N64Bake* bake);
+void n64_bake_free(N64Bake* bake);
+
+bool n64_trace_begin(const char* filename);
+bool n64_trace_end(void);
+N64Trace* n64_trace_load(const char* filename);
+void n64_trace_replay(const N64Trace* trace);
+void n64_trace_free(N64Trace* trace);
 
 bool n64_culling(bool state);
 void n64_fog(int near, int far, uint8_t r, uint8_t g, uint8_t b);
@@ -133,7 +210,13 @@ bool n64_light_bind_dir(int8_t x, int8_t y, int8_t z, uint8_t r, uint8_t g, uint
 bool n64_light_bind_point(int16_t x, int16_t y, int16_t z, uint8_t r, uint8_t g, uint8_t b);
 void n64_light_set_ambient(uint8_t r, uint8_t g, uint8_t b);
 
+bool n64_stats(bool state);
+void n64_stats_get(N64Stats* dst);
+void n64_stats_reset(void);
+const char* n64_stats_opname(uint8_t op);
+
 void n64_set_tri_callback(void* userData, N64TriCallback callback);
+void n64_set_tri_batch_callback(void* userData, N64TriBatchCallback callback);
 void n64_set_cull_callback(void* userData, N64CullCallback callback);
 
 #endif
@@ -0,0 +1,128 @@
+#ifndef N64BACKEND_H
+#define N64BACKEND_H
+
+/*
+ * n64backend.h <z64.me>
+ *
+ * everything the n64 renderer needs from the graphics api, so the
+ * display list interpreter can also run without an OpenGL context
+ *
+ */
+
+#include <stdint.h>
+#include <shader.h>
+#include "n64.h"
+
+#ifndef N64_BACKEND_DEFAULT
+	#define N64_BACKEND_DEFAULT n64_backend_gl
+#endif
+
+enum N64Cull {
+	N64_CULL_NONE,
+	N64_CULL_FRONT,
+	N64_CULL_BACK,
+	N64_CULL_FRONT_AND_BACK
+};
+
+enum N64Filter {
+	N64_FILTER_NEAREST,
+	N64_FILTER_LINEAR
+};
+
+enum N64Wrap {
+	N64_WRAP_REPEAT,
+	N64_WRAP_MIRRORED_REPEAT,
+	N64_WRAP_CLAMP
+};
+
+typedef struct N64Backend {
+	const char* name;
+	
+	/* called before each display list, sets up vertex arrays etc */
+	void (*begin)(void);
+	
+	/* called after each display list; draws may be held back until then */
+	void (*end)(void);
+	
+	/* geometry */
+	void (*vertices)(const N64Vtx* vtx, uint32_t num);
+	void (*draw_triangles)(const uint8_t* indices, uint32_t num);
+	
+	/* a triangle list of its own, for the outline shader; n64.c sets up
+	 * the render state for the whole outline pass */
+	void (*draw_outline)(const N64Vtx* vtx, uint32_t num);
+	
+	/* persistent geometry for baked display lists; mesh_draw binds its
+	 * own vertex arrays, so call begin() again before streaming */
+	uint32_t (*mesh_new)(const N64Vtx* vtx, uint32_t numVtx, const uint32_t* indices, uint32_t numIndices);
+	void (*mesh_draw)(uint32_t mesh, uint32_t first, uint32_t num);
+	void (*mesh_delete)(uint32_t mesh);
+	
+	/* render state */
+	void (*blend)(bool enable);
+	void (*depth_test)(bool enable);
+	void (*depth_mask)(bool enable);
+	void (*cull)(enum N64Cull mode);
+	void (*polygon_offset)(float factor, float units);
+	void (*polygon_offset_fill)(bool enable);
+	void (*polygon_offset_line)(bool enable);
+	void (*wireframe)(bool enable);
+	void (*stencil)(bool enable);
+	
+	/* textures; filter, wrap, and upload act on the last bound texture */
+	uint32_t (*texture_new)(void);
+	void (*texture_delete)(uint32_t tex);
+	void (*texture_bind)(int unit, uint32_t tex);
+	void (*texture_filter)(enum N64Filter filter);
+	void (*texture_wrap)(enum N64Wrap s, enum N64Wrap t);
+	void (*texture_upload)(int width, int height, const void* rgba8888);
+	
+	/* shaders */
+	Shader* (*shader_new)(void);
+	void (*shader_update)(Shader* s, const char* vs, const char* fs);
+	bool (*shader_use)(Shader* s);
+	void (*shader_delete)(Shader* s);
+	void (*shader_mat4)(Shader* s, const char* name, const void* m);
+	void (*shader_vec2)(Shader* s, const char* name, float v0, float v1);
+	void (*shader_vec3)(Shader* s, const char* name, float v0, float v1, float v2);
+	void (*shader_vec4)(Shader* s, const char* name, float v0, float v1, float v2, float v3);
+	void (*shader_int)(Shader* s, const char* name, int v);
+	void (*shader_float)(Shader* s, const char* name, float v);
+	
+	/* uniform blocks are shared by every shader; shaders don't assign
+	 * bindings, so whichever block one declares reads binding 0 */
+	void (*uniform_block)(int binding, const void* data, uint32_t size);
+} N64Backend;
+
+/* records everything that would have been submitted, for benchmarking */
+typedef struct N64NullStats {
+	uint64_t begins;
+	uint64_t vertexUploads;
+	uint64_t vertices;
+	uint64_t draws;
+	uint64_t triangles;
+	uint64_t outlineDraws;
+	uint64_t meshes;
+	uint64_t meshDraws;
+	uint64_t stateChanges;
+	uint64_t textures;
+	uint64_t textureBinds;
+	uint64_t textureUploads;
+	uint64_t texelBytes;
+	uint64_t shaders;
+	uint64_t shaderCompiles;
+	uint64_t shaderBinds;
+	uint64_t uniforms;
+} N64NullStats;
+
+extern const N64Backend n64_backend_gl;
+extern const N64Backend n64_backend_gl_packed; /* streams vertices as bytes and shorts where it can */
+extern const N64Backend n64_backend_null;
+
+void n64_set_backend(const N64Backend* backend);
+const N64Backend* n64_get_backend(void);
+
+void n64_backend_null_stats(N64NullStats* dst);
+void n64_backend_null_reset(void);
+
+#endif
@@ -22,11 +22,16 @@
 #include <stdarg.h>
 #include <float.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+#endif
 
 #include <n64.h>
 #include <n64texconv.h>
 #include <bigendian.h>
-#include <glad/glad.h>
+#include <n64backend.h>
 
 #include "n64types.h"
 
@@ -53,47 +58,86 @@ GbiGfx* n64_poly_xlu_disp;
 void* n64_segment[N64_SEGMENT_MAX];
 bool n64_tick_20fps;
 
-static GLuint gVAO;
-static GLuint gVBO;
-static GLuint gEBO;
-static GLuint gTexel[N64_TEXTURE_CACHE_SIZE];
-static GLubyte gIndices[4096];
-static N64Vtx sVbuf[N64_VBUF_MAX];
-static uint32_t gIndicesUsed = 0;
-static int gTexelCacheCount = 0;
-static void* gTexelDict[N64_TEXTURE_CACHE_SIZE];
-static GLint gFilterMode = GL_LINEAR;
+static _Thread_local const N64Backend* gBackend = &N64_BACKEND_DEFAULT;
+static uint32_t* gTexel; /* texture names, created ahead of time */
+static uint32_t gTexelNum;
+static uint32_t gTexelMissed; /* by decode threads, since the last flush */
+static _Thread_local uint8_t gIndices[4096];
+static _Thread_local N64Vtx sVbuf[N64_VBUF_MAX];
+static _Thread_local uint8_t sVbufCull[N64_VBUF_MAX]; /* point lights out of reach */
+static _Thread_local bool sVbufLoaded[N64_VBUF_MAX]; /* skipped while geometry is hidden */
+static _Thread_local uint32_t gIndicesUsed = 0;
+static uint32_t gTexelCacheCount = 0; /* names in use */
+static TexelDict* gTexelDict; /* open addressing, keyed by texture data */
+static uint32_t gTexelDictSize;
+static uint32_t gTexelDictCount;
+static TexelShare* gTexelShare; /* the same, keyed by texel contents */
+static uint32_t gTexelShareSize;
+static _Thread_local enum N64Filter gFilterMode = N64_FILTER_LINEAR;
 
 static void* s_tri_callback_data;
+static void* s_tri_batch_callback_data;
 static void* s_cull_callback_data;
 static N64TriCallback s_tri_callback;
+static N64TriBatchCallback s_tri_batch_callback;
 static N64CullCallback s_cull_callback;
+static _Thread_local float sTriBatchPos[3][N64_ARRAY_COUNT(gIndices)];
 
-static uint32_t gSetId;
-static uint32_t gRdpHalf1;
-static uint32_t gRdpHalf2;
-static uintptr_t gPtrHi = 0;
-static bool gPtrHiSet = false;
-static Shader* gShader = 0;
+static _Thread_local uint32_t gSetId;
+static _Thread_local uint32_t gRdpHalf1;
+static _Thread_local uint32_t gRdpHalf2;
+static _Thread_local uintptr_t gPtrHi = 0;
+static _Thread_local bool gPtrHiSet = false;
+static _Thread_local Shader* gShader = 0;
 static Shader* sOutlineShader = 0;
 
-static bool gHideGeometry = false;
-static bool gVertexColors = false;
+/* one list for geometry that culls faces and one for geometry that
+ * doesn't, for each display list n64_buffer_flush() decodes at once */
+static OutlineList sOutlineBuf[3][2];
+static _Thread_local OutlineList* sOutline = sOutlineBuf[0];
+static bool sOutlineDeferred = false; /* until n64_buffer_flush() is done */
+
+static _Thread_local bool gHideGeometry = false;
+static _Thread_local bool gVertexColors = false;
 static bool gFogEnabled = true;
-static bool gForceBl = false;
-static bool gCvgXalpha = false;
-static bool gGxOutline = false;
+static _Thread_local bool gForceBl = false;
+static _Thread_local bool gCvgXalpha = false;
+static _Thread_local bool gGxOutline = false;
 
 static bool s_cull_enabled = true;
-static int gPolygonOffset = 0;
+static _Thread_local bool sCullFrustum = true; /* not while baking */
+static _Thread_local Mtx sCullMtx; /* projection * view */
+static _Thread_local int gPolygonOffset = 0;
 static enum N64GeoLayer gOnlyThisGeoLayer;
-static enum N64ZMode gOnlyThisZmode;
-static enum N64ZMode gCurrentZmode;
+static _Thread_local enum N64ZMode gOnlyThisZmode;
+static _Thread_local enum N64ZMode gCurrentZmode;
 static ShaderList* sShaderList = 0;
 static int sLightNum;
 static GbiLightsN sLights;
+static bool sLightsDirty = true;
+static bool sTraceCapture = false;
+static const N64Trace* sTraceReplay = 0;
+static bool sStatsEnabled = false;
+static N64Stats sStats;
+static const void* sStatsPalette[256];
+static bool sThreads = false;
+static bool sSort = false;
+static bool sParallel = false; /* decode threads are running */
 
-static struct {
+/* guards the texture, shader, and display list caches while decoding in parallel */
+static pthread_mutex_t sCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* set by G_DL and G_BRANCH_Z, followed by the display list walker */
+static _Thread_local struct {
+	void* dlist;
+	bool  set;
+	bool  push;
+} sDlJump;
+
+/* n64_segment, or a decode thread's own copy of it */
+static _Thread_local void** sSegment = n64_segment;
+
+static _Thread_local struct {
 	//float model[16];
 	Mtx  view;
 	Mtx  normal;
@@ -107,7 +151,7 @@ static struct {
 	float color[3];
 } gFog;
 
-static struct {
+static _Thread_local struct {
 	struct {
 		void*    data;
 		int      level;
@@ -142,6 +186,7 @@ static struct {
 		int   width;
 	} timg;
 	uint16_t pal[256]; /* palette */
+	uint32_t palHash;
 	int      mtlReady;
 	int      texWidth;
 	int      texHeight;
@@ -445,30 +490,76 @@ static void CalculateTexSize(int id)
 }
 #endif // RENDERHOOK_UOT
 
+/* cycle counter on x86, nanoseconds elsewhere */
+static inline uint64_t stats_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* palettes past the first 256 are all counted as distinct */
+static void stats_palette(const void* addr) {
+	uint32_t i;
+	
+	for (i = 0; i < sStats.palettes && i < N64_ARRAY_COUNT(sStatsPalette); ++i) {
+		if (sStatsPalette[i] == addr)
+			return;
+	}
+	
+	if (i < N64_ARRAY_COUNT(sStatsPalette))
+		sStatsPalette[i] = addr;
+	sStats.palettes += 1;
+}
+
+/* CI textures are cached per palette, so the palette is hashed once here */
+static void palette_load(const void* src, size_t size) {
+	const uint32_t* w = (const void*)gMatState.pal;
+	uint32_t hash = 2166136261u; // fnv-1a
+	
+	memcpy(gMatState.pal, src, size);
+	for (uint32_t i = 0; i < sizeof(gMatState.pal) / sizeof(*w); ++i)
+		hash = (hash ^ w[i]) * 16777619u;
+	gMatState.palHash = hash;
+}
+
+static void trace_record(const void* data, uint32_t size);
+static void* trace_translate(const N64Trace* trace, const void* ptr);
+static void trace_draw(const void* dlist);
+
+/* remember what the interpreter reads while a trace is being captured */
+static inline void trace_touch(const void* data, uint32_t size) {
+	if (sTraceCapture && data && size)
+		trace_record(data, size);
+}
+
+static inline void* cmd_segment(const GbiCmd* cmd) {
+	/* use the address resolved when the display list was decoded, if any */
+	if (cmd->ptr)
+		return cmd->ptr;
+	
+	return n64_segment_get(cmd->w1);
+}
+
 #ifdef RENDERHOOK_UOT // implementation
 
 #define RENDERHOOK_UOT_COMMON \
-	const uint8_t *data = cmd; (void)data; \
-	uint32_t w0 = u32r(data); (void)w0; \
-	uint32_t w1 = u32r(data + 4); (void)w1; \
+	uint32_t w0 = cmd->w0; (void)w0; \
+	uint32_t w1 = cmd->w1; (void)w1; \
 
-static bool UOT_gbiFunc_settimg(void* cmd)
+static bool UOT_gbiFunc_settimg(const GbiCmd* cmd)
 {
 	RENDERHOOK_UOT_COMMON
 	
-	void* imgaddr = n64_segment_get(w1);
+	void* imgaddr = cmd_segment(cmd);
 	if (!imgaddr)
 	{
-		static uint8_t *blank = 0;
-		
-		if (!blank)
-		{
-			int mem = 4096;
-			
-			blank = malloc(mem);
-			
-			memset(blank, -1, mem);
-		}
+		static uint8_t blank[4096] = { [0 ... 4095] = 0xff };
 		
 		imgaddr = blank;
 		
@@ -502,7 +593,7 @@ static bool UOT_gbiFunc_settimg(void* cmd)
 	return false;
 }
 
-static bool UOT_gbiFunc_settile(void* cmd)
+static bool UOT_gbiFunc_settile(const GbiCmd* cmd)
 {
 	RENDERHOOK_UOT_COMMON
 	
@@ -541,11 +632,11 @@ static bool UOT_gbiFunc_settile(void* cmd)
 	return false;
 }
 
-static bool UOT_gbiFunc_settilesize(void* cmd)
+static bool UOT_gbiFunc_settilesize(const GbiCmd* cmd)
 {
 	RENDERHOOK_UOT_COMMON
 	
-	int i = data[4];
+	int i = w1 >> 24;
 	if (i > 1)
 		return false;
 	
@@ -565,7 +656,7 @@ static bool UOT_gbiFunc_settilesize(void* cmd)
 	return false;
 }
 
-static bool UOT_gbiFunc_texture(void* cmd)
+static bool UOT_gbiFunc_texture(const GbiCmd* cmd)
 {
 	RENDERHOOK_UOT_COMMON
 	
@@ -583,14 +674,14 @@ static bool UOT_gbiFunc_texture(void* cmd)
 			Textures(i).T_Scale = 1.0F;
 		
 		// uot algorithm (above) doesn't work, but this does:
-		Textures(i).S_Scale = u16r(data + 4) * (1.0f / UINT16_MAX);
-		Textures(i).T_Scale = u16r(data + 6) * (1.0f / UINT16_MAX);
+		Textures(i).S_Scale = (w1 >> 16) * (1.0f / UINT16_MAX);
+		Textures(i).T_Scale = (w1 & 0xffff) * (1.0f / UINT16_MAX);
 	}
 	
 	return false;
 }
 
-static bool UOT_gbiFunc_loadtlut(void* cmd)
+static bool UOT_gbiFunc_loadtlut(const GbiCmd* cmd)
 {
 	RENDERHOOK_UOT_COMMON
 	
@@ -604,7 +695,10 @@ static bool UOT_gbiFunc_loadtlut(void* cmd)
 	{
 		size_t size = ALIGN8(G_SIZ_BYTES(G_IM_SIZ_16b) * count);
 		
-		memcpy(gMatState.pal, realAddr, size);
+		if (sStatsEnabled)
+			stats_palette(realAddr);
+		trace_touch(realAddr, size);
+		palette_load(realAddr, size);
 	}
 	
 	return false;
@@ -614,14 +708,17 @@ static bool UOT_gbiFunc_loadtlut(void* cmd)
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-static void n64_drawImpl(void* dlist);
+static void* segment_resolve(unsigned int segaddr);
+static bool vtxcache_key(const void* src, VtxKey* key, uint32_t* hash);
+static const VtxCache* vtxcache_get(const void* src, uint32_t num, const VtxKey* key, uint32_t hash);
+static void vtxcache_put(const void* src, uint32_t num, const VtxKey* key, uint32_t hash, const N64Vtx* vtx);
 
 static ShaderList* ShaderList_new(uint64_t uuid, void* next) {
 	ShaderList* l = calloc(1, sizeof(*l));
 	
 	l->uuid = uuid;
 	l->next = next;
-	l->shader = Shader_new();
+	l->shader = gBackend->shader_new();
 	
 	return l;
 }
@@ -631,18 +728,22 @@ static Shader* ShaderList_add(uint64_t uuid, bool* isNew) {
 	
 	assert(isNew);
 	
+	pthread_mutex_lock(&sCacheLock);
 	if (!sShaderList)
 		sShaderList = ShaderList_new(0, 0);
 	
 	*isNew = false;
 	for (l = sShaderList; l; l = l->next) {
 		if (l->uuid == uuid)
-			return l->shader;
+			break;
 	}
 	
-	*isNew = true;
-	l = ShaderList_new(uuid, sShaderList);
-	sShaderList = l;
+	if (!l) {
+		*isNew = true;
+		l = ShaderList_new(uuid, sShaderList);
+		sShaderList = l;
+	}
+	pthread_mutex_unlock(&sCacheLock);
 	
 	return l->shader;
 }
@@ -656,7 +757,7 @@ static void ShaderList_cleanup(void) {
 	
 	for (l = sShaderList; l; l = next) {
 		if (l->shader)
-			Shader_delete(l->shader);
+			gBackend->shader_delete(l->shader);
 		next = l->next;
 		free(l);
 	}
@@ -776,38 +877,243 @@ static const char* mtl_alpha_str(int idx, int v) {
 	return "0.0";
 }
 
-static void do_mtl(void* addr) {
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static uint32_t texel_hash(const TexelKey* key) {
+	uint64_t h = (uintptr_t)key->data;
+	
+	h = (h ^ key->palHash) * 0x9E3779B97F4A7C15ull;
+	h = (h ^ ((uint64_t)key->width << 32 | key->height << 16 | key->lineSize)) * 0x9E3779B97F4A7C15ull;
+	h = (h ^ (key->fmt << 8 | key->siz)) * 0x9E3779B97F4A7C15ull;
+	
+	return h >> 32;
+}
+
+/* the slot holding key, or the empty one it goes in */
+static TexelDict* texel_find(const TexelKey* key, uint32_t hash) {
+	uint32_t mask = gTexelDictSize - 1;
+	uint32_t i = hash & mask;
+	
+	while (gTexelDict[i].key.data && (gTexelDict[i].hash != hash || memcmp(&gTexelDict[i].key, key, sizeof(*key))))
+		i = (i + 1) & mask;
+	
+	return &gTexelDict[i];
+}
+
+/* the slot holding hash, or the empty one it goes in */
+static TexelShare* texel_share_find(uint64_t hash) {
+	uint32_t mask = gTexelShareSize - 1;
+	uint32_t i = (hash >> 32) & mask;
+	
+	while (gTexelShare[i].hash && gTexelShare[i].hash != hash)
+		i = (i + 1) & mask;
+	
+	return &gTexelShare[i];
+}
+
+/* one entry per texture name in use, at most half full as well */
+static void texel_share_grow(void) {
+	TexelShare* old = gTexelShare;
+	uint32_t oldSize = gTexelShareSize;
+	
+	gTexelShareSize = oldSize ? oldSize * 2 : 64;
+	gTexelShare = calloc(gTexelShareSize, sizeof(*gTexelShare));
+	assert(gTexelShare);
+	
+	for (uint32_t i = 0; i < oldSize; ++i) {
+		if (old[i].hash)
+			*texel_share_find(old[i].hash) = old[i];
+	}
+	
+	free(old);
+}
+
+/* kept at most half full, so probes stay short */
+static void texel_dict_grow(void) {
+	TexelDict* old = gTexelDict;
+	uint32_t oldSize = gTexelDictSize;
+	
+	gTexelDictSize = oldSize ? oldSize * 2 : 64;
+	gTexelDict = calloc(gTexelDictSize, sizeof(*gTexelDict));
+	assert(gTexelDict);
+	
+	for (uint32_t i = 0; i < oldSize; ++i) {
+		if (old[i].key.data)
+			*texel_find(&old[i].key, old[i].hash) = old[i];
+	}
+	
+	free(old);
+}
+
+/* only the thread the backend belongs to can create textures */
+static void texel_reserve(uint32_t num) {
+	if (gTexelNum >= num)
+		return;
+	
+	gTexel = realloc(gTexel, sizeof(*gTexel) * num);
+	assert(gTexel);
+	while (gTexelNum < num)
+		gTexel[gTexelNum++] = gBackend->texture_new();
+}
+
+/* the same image can be drawn as another format or size, or with another
+ * palette, and each of those is a texture of its own; the size is the one
+ * do_mtl() converts with */
+static void texel_key(int tile, TexelKey* key, int width, int height, int fmt, int siz) {
+	memset(key, 0, sizeof(*key));
+	key->data = gMatState.tile[tile].data;
+#ifdef RENDERHOOK_UOT
+	(void)width;
+	(void)height;
+	key->width = Textures(tile).Width;
+	key->height = Textures(tile).Height;
+	key->lineSize = Textures(tile).LineSize;
+#else
+	if (width * height > 4096) width = height = 32; /* as do_mtl() clamps it */
+	key->width = width;
+	key->height = height;
+	key->lineSize = gMatState.tile[tile].line;
+#endif
+	key->fmt = fmt;
+	key->siz = siz;
+	
+	if (fmt == G_IM_FMT_CI)
+		key->palHash = gMatState.palHash;
+}
+
+/* fnv-1a over the texels do_mtl() converts, a row at a time and a word
+ * at a time, then mixed so every bit of the result counts; identical
+ * images at different addresses share one texture by this */
+static uint64_t texel_content_hash(const TexelKey* key) {
+	const uint8_t* src = key->data;
+	uint32_t row = ((key->width << key->siz) + 1) / 2;
+#ifdef RENDERHOOK_UOT
+	uint32_t line = key->lineSize * sizeof(uint64_t);
+#else
+	uint32_t line = 0;
+#endif
+	uint32_t rows = key->height;
+	uint64_t h = 14695981039346656037ull;
+	
+	/* rows without a line size are back to back */
+	if (!line) {
+		row *= rows;
+		rows = 1;
+	}
+	
+	/* a texture that ends up shared is never uploaded, so a trace
+	 * has to get the texels from here */
+	if (rows)
+		trace_touch(src, (rows - 1) * line + row);
+	
+	h = (h ^ key->palHash) * 1099511628211ull;
+	h = (h ^ ((uint64_t)key->width << 32 | key->height << 16 | key->fmt << 8 | key->siz)) * 1099511628211ull;
+	for (uint32_t y = 0; y < rows; ++y, src += line) {
+		const uint8_t* p = src;
+		uint32_t n = row;
+		
+		for (; n >= 8; n -= 8, p += 8) {
+			uint64_t w;
+			
+			memcpy(&w, p, sizeof(w));
+			h = (h ^ w) * 1099511628211ull;
+		}
+		for (; n; n--, p++)
+			h = (h ^ *p) * 1099511628211ull;
+	}
+	
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	
+	return h | 1; /* 0 marks an empty slot */
+}
+
+/* the texture name for key, or 0 for a decode thread that ran out of
+ * names; that one is left out of the cache and tried again next flush */
+static uint32_t texel_get(const TexelKey* key, bool* isNew) {
+	uint32_t hash = texel_hash(key);
+	uint64_t content;
+	TexelDict* dict;
+	TexelShare* share;
+	uint32_t tex = 0;
+	bool found;
+	
+	*isNew = false;
+	if (!key->data)
+		return 0;
+	
+	pthread_mutex_lock(&sCacheLock);
+	if (gTexelDictCount * 2 >= gTexelDictSize)
+		texel_dict_grow();
+	
+	dict = texel_find(key, hash);
+	found = dict->key.data != NULL;
+	tex = dict->tex;
+	pthread_mutex_unlock(&sCacheLock);
+	if (found)
+		return tex;
+	
+	/* hashed without holding the lock, so look again after */
+	content = texel_content_hash(key);
+	
+	pthread_mutex_lock(&sCacheLock);
+	if (gTexelDictCount * 2 >= gTexelDictSize)
+		texel_dict_grow();
+	if (gTexelCacheCount * 2 >= gTexelShareSize)
+		texel_share_grow();
+	
+	dict = texel_find(key, hash);
+	share = texel_share_find(content);
+	if (dict->key.data) {
+		tex = dict->tex;
+	} else if (share->hash) {
+		dict->key = *key;
+		dict->hash = hash;
+		dict->tex = tex = share->tex;
+		gTexelDictCount += 1;
+		
+		if (sStatsEnabled) {
+			sStats.texturesShared += 1;
+			sStats.textureBytesSaved += key->width * key->height * 4;
+		}
+	} else {
+		if (gTexelCacheCount == gTexelNum && !sParallel)
+			texel_reserve(gTexelNum * 2);
+		
+		if (gTexelCacheCount < gTexelNum) {
+			*isNew = true;
+			share->hash = content;
+			dict->key = *key;
+			dict->hash = hash;
+			dict->tex = tex = share->tex = gTexel[gTexelCacheCount++];
+			gTexelDictCount += 1;
+			
+			if (sStatsEnabled)
+				sStats.textures += 1;
+		} else {
+			gTexelMissed += 1;
+		}
+	}
+	pthread_mutex_unlock(&sCacheLock);
+	
+	return tex;
+}
+
+static void do_mtl(void) {
 	int tile = 0; /* G_TX_RENDERTILE */
 	
 	/* update texture image associated with each tile */
 	for (tile = 0; tile < 2; ++tile) {
-		int i;
+		TexelKey key;
 		bool isNew = false;
+		bool upload;
 		
 		if (!gMatState.tile[tile].doUpdate)
 			continue;
 		
-		for (i = 0; i < N64_TEXTURE_CACHE_SIZE; ++i) {
-			if (gMatState.tile[tile].data == gTexelDict[i])
-				break;
-			
-			if (gTexelDict[i] == 0) {
-				isNew = true;
-				gTexelDict[i] = gMatState.tile[tile].data;
-				break;
-			}
-		}
-		// no match found
-		if (i == N64_TEXTURE_CACHE_SIZE) {
-			i = 0;
-		}
-		glActiveTexture(GL_TEXTURE0 + tile);
-		glBindTexture(GL_TEXTURE_2D, gTexel[i]);
-		
-		// set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, gFilterMode);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, gFilterMode);
-		
 		gMatState.tile[tile].doUpdate = false;
 		int width = ((gMatState.tile[tile].lrs >> 2) - (gMatState.tile[tile].uls >> 2)) + 1;
 		int height = ((gMatState.tile[tile].lrt >> 2) - (gMatState.tile[tile].ult >> 2)) + 1;
@@ -828,8 +1134,15 @@ static void do_mtl(void* addr) {
 		int fmt = gMatState.tile[tile].fmt;
 		int siz = gMatState.tile[tile].siz;
 		
-		unsigned wrapT = GL_REPEAT;
-		unsigned wrapS = GL_REPEAT;
+		texel_key(tile, &key, width, height, fmt, siz);
+		gBackend->texture_bind(tile, texel_get(&key, &isNew));
+		upload = isNew;
+		
+		// set texture filtering parameters
+		gBackend->texture_filter(gFilterMode);
+		
+		enum N64Wrap wrapT = N64_WRAP_REPEAT;
+		enum N64Wrap wrapS = N64_WRAP_REPEAT;
 		
 		gMatState.texWidth = width;
 		gMatState.texHeight = height;
@@ -843,7 +1156,7 @@ static void do_mtl(void* addr) {
 			- (gMatState.tile[tile].ul##axis >> 2) \
 			) + 1 \
 		) != (1 << Textures(tile).Mask##AXIS) \
-	) { wrap##AXIS = GL_MIRRORED_REPEAT; break; }
+	) { wrap##AXIS = N64_WRAP_MIRRORED_REPEAT; break; }
 // this hotfix addresses clamped textures that actually wrap
 #define CLAMP_REPEAT_HOTFIX(AXIS, axis) \
 	if (Textures(tile).Mask##AXIS \
@@ -853,7 +1166,7 @@ static void do_mtl(void* addr) {
 			) + 1 \
 		) != (1 << Textures(tile).Mask##AXIS) \
 	) \
-		wrap##AXIS = GL_REPEAT;
+		wrap##AXIS = N64_WRAP_REPEAT;
 // 99% of things look fine w/o the above hotfixes, they mostly
 // exist to address some very rare/odd corner cases
 
@@ -862,24 +1175,24 @@ static void do_mtl(void* addr) {
 		//      (do it at the shader level)
 		switch (gMatState.tile[tile].cmT) {
 			case G_TX_MIRROR:
-				wrapT = GL_MIRRORED_REPEAT;
+				wrapT = N64_WRAP_MIRRORED_REPEAT;
 				break;
 			case G_TX_CLAMP | G_TX_MIRROR:
 				MIRROR_CLAMP_HOTFIX(T, t)
 				// fallthrough
 			case G_TX_CLAMP:
-				wrapT = GL_CLAMP_TO_EDGE;
+				wrapT = N64_WRAP_CLAMP;
 				break;
 		}
 		switch (gMatState.tile[tile].cmS) {
 			case G_TX_MIRROR:
-				wrapS = GL_MIRRORED_REPEAT;
+				wrapS = N64_WRAP_MIRRORED_REPEAT;
 				break;
 			case G_TX_CLAMP | G_TX_MIRROR:
 				MIRROR_CLAMP_HOTFIX(S, s)
 				// fallthrough
 			case G_TX_CLAMP:
-				wrapS = GL_CLAMP_TO_EDGE;
+				wrapS = N64_WRAP_CLAMP;
 				break;
 		}
 		
@@ -887,8 +1200,7 @@ static void do_mtl(void* addr) {
 		CLAMP_REPEAT_HOTFIX(T, t)
 		CLAMP_REPEAT_HOTFIX(S, s)
 		
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+		gBackend->texture_wrap(wrapS, wrapT);
 		
 		if (!isNew && gHideGeometry)
 			continue;
@@ -904,13 +1216,23 @@ static void do_mtl(void* addr) {
 		//fprintf(stderr, "%d %d\n", fmt, siz);
 		if (width * height > 4096) width = height = 32; // FIXME getting wrong dimensions
 		//memcpy(tmem, src, bytes); /* TODO dxt emulation requires line-by-line */
-		if (isNew && gTexelCacheCount < N64_TEXTURE_CACHE_SIZE)	{
+		if (upload) {
 			uint8_t wow[4096 * 8];
 		#ifdef RENDERHOOK_UOT
 			width = Textures(tile).Width;
 			height = Textures(tile).Height;
 			//fprintf(stderr, "append %p %08x %dx%d\n", gMatState.tile[tile].data, Textures(tile).Dram, width, height);
 		#endif
+			if (sTraceCapture) {
+			#ifdef RENDERHOOK_UOT
+				int line = Textures(tile).LineSize * sizeof(uint64_t);
+			#else
+				int line = 0;
+			#endif
+				int row = ((width << siz) + 1) / 2;
+				
+				trace_touch(gMatState.tile[tile].data, line > 0 ? (height - 1) * line + row : height * row);
+			}
 			n64texconv_to_rgba8888(
 				wow
 				,
@@ -932,9 +1254,7 @@ static void do_mtl(void* addr) {
 			#endif
 			);
 			//fprintf(stderr, "width height %d %d\n", width, height);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, wow);
-			//glGenerateMipmap(GL_TEXTURE_2D);
-			gTexelCacheCount += 1;
+			gBackend->texture_upload(width, height, wow);
 		}
 	}
 	
@@ -948,6 +1268,8 @@ static void do_mtl(void* addr) {
 			| ((uint64_t)(gCvgXalpha || gForceBl) << 62)
 			| ((uint64_t)(gMatState.xhighlight.mode != 0) << 61)
 			| ((uint64_t)gMatState.mixFog << 60)
+			| ((uint64_t)!gVertexColors << 59)
+			| ((uint64_t)gMatState.texgen << 57)
 			| ((uint64_t)(gMatState.setcombine.hi & 0x00ffffff) << 32)
 			| (gMatState.setcombine.lo)
 		;
@@ -969,7 +1291,7 @@ static void do_mtl(void* addr) {
 		if (isNew) {
 			
 			//crustify
-			const char *vtx = SHADER_SOURCE(
+			char vtx[4096] = SHADER_SOURCE(
 				layout (location = 0) in vec4 aPos;
 				layout (location = 1) in vec4 aColor;
 				layout (location = 2) in vec2 aTexCoord0;
@@ -988,6 +1310,9 @@ static void do_mtl(void* addr) {
 				uniform vec4 uMultiplyTexCoord;
 				uniform vec4 uShiftTexCoord;
 			
+				vec3 light();
+				vec4 texcoords();
+			
 				void main() {
 				float fogM = uFog.x;
 				float fogO = uFog.y;
@@ -995,8 +1320,9 @@ static void do_mtl(void* addr) {
 			
 				gl_Position = projection * view * aPos;
 				vColor = aColor;
-				TexCoord0 = uMultiplyTexCoord.xy * vec2(aTexCoord0.x, aTexCoord0.y) - uShiftTexCoord.xy;
-				TexCoord1 = uMultiplyTexCoord.zw * vec2(aTexCoord1.x, aTexCoord1.y) - uShiftTexCoord.zw;
+				vec4 st = texcoords();
+				TexCoord0 = st.xy;
+				TexCoord1 = st.zw;
 				if (wow.w < 0)
 				{
 					vFog = -fogM + fogO;
@@ -1006,7 +1332,7 @@ static void do_mtl(void* addr) {
 					vFog = wow.z / wow.w * fogM + fogO;
 				}
 				vFog = clamp(vFog, 0.0, 255.0) / 255;
-				vLightColor = vec3(1.0);
+				vLightColor = light();
 			}
 			);
 			
@@ -1033,6 +1359,68 @@ static void do_mtl(void* addr) {
 			);
 			//uncrustify
 			
+			/* construct vertex shader */
+			{
+				char* v = vtx + strlen(vtx);
+				
+				#define ADD(X) v = strcatt(v, X)
+				
+				if (!gVertexColors || gMatState.texgen)
+					ADD("layout (location = 4) in vec3 aNorm;");
+				
+				if (gVertexColors)
+					ADD("vec3 light(){ return vec3(1.0); }");
+				else {
+					/* see LightBlock */
+					ADD("layout (std140) uniform N64Lights {");
+					ADD("vec4 uLightAmbient;");
+					ADD("vec4 uLightDir[7];");
+					ADD("vec4 uLightColor[7];");
+					ADD("vec4 uLightPos[7];");
+					ADD("vec4 uLightAtten[7];");
+					ADD("ivec4 uLightNum;");
+					ADD("};");
+					ADD("uniform int uLightCull;");
+					ADD("vec3 light(){");
+					ADD("vec3 sum = uLightAmbient.rgb;");
+					ADD("for (int i = 0; i < uLightNum.x; ++i) {");
+					ADD("if (uLightAtten[i].w == 0.0) {");
+					ADD("sum += uLightColor[i].rgb * clamp(dot(aNorm, uLightDir[i].xyz), 0.0, 1.0);");
+					ADD("continue;");
+					ADD("}");
+					ADD("if ((uLightCull & (1 << i)) != 0) continue;");
+					ADD("vec3 d = uLightPos[i].xyz - aPos.xyz;");
+					ADD("float len2 = dot(d, d);");
+					ADD("if (len2 > uLightPos[i].w * uLightPos[i].w) continue;");
+					ADD("float len = sqrt(len2);");
+					ADD("float at = uLightAtten[i].x + uLightAtten[i].y * len + uLightAtten[i].z * len2;");
+					ADD("float ndl = len > 0.0 ? clamp(dot(aNorm, d / len), 0.0, 1.0) : 1.0;");
+					ADD("if (at > 0.0) sum += uLightColor[i].rgb * ndl / at;");
+					ADD("}");
+					ADD("return clamp(sum, 0.0, 1.0);");
+					ADD("}");
+				}
+				
+				/* texgen approximates the environment mapping from the
+				 * view space normal, same range for spherical and linear */
+				if (!gMatState.texgen)
+					ADD("vec4 texcoords(){ return uMultiplyTexCoord * vec4(aTexCoord0, aTexCoord1) - uShiftTexCoord; }");
+				else {
+					ADD("uniform mat4 uNormalMatrix;");
+					ADD("vec4 texcoords(){");
+					ADD("vec3 n = mat3(uNormalMatrix) * aNorm;");
+					ADD("n = dot(n, n) > 0.0 ? normalize(n) : n;");
+					if (gMatState.texgen & (N64_RSP_TEXTURE_GEN_LINEAR >> 18))
+						ADD("vec2 st = acos(-n.xy) * (2.0 / 3.14159265) - 1.0;");
+					else
+						ADD("vec2 st = n.xy;");
+					ADD("return vec4(st, st) - uShiftTexCoord;");
+					ADD("}");
+				}
+				
+#undef ADD
+			}
+			
 			/* construct fragment shader */
 			{
 				char* f = frag + strlen(frag);
@@ -1120,45 +1508,54 @@ static void do_mtl(void* addr) {
 #undef ADDF
 			}
 			
-			Shader_update(shader, vtx, frag);
+			gBackend->shader_update(shader, vtx, frag);
 		}
 		
 		// using new shader, so update view-projection matrices
 		gShader = shader;
-		if (Shader_use(shader))	{
-			Shader_setMat4(shader, "view", &gMatrix.view);
-			Shader_setMat4(shader, "projection", &gMatrix.projection);
+		if (gBackend->shader_use(shader))	{
+			gBackend->shader_mat4(shader, "view", &gMatrix.view);
+			gBackend->shader_mat4(shader, "projection", &gMatrix.projection);
+			if (gMatState.texgen)
+				gBackend->shader_mat4(shader, "uNormalMatrix", &gMatrix.normal);
 		}
 		
 		// populate other misc variables
-		Shader_setVec4(shader, "uPrimColor", gMatState.prim.r, gMatState.prim.g, gMatState.prim.b, gMatState.prim.alpha);
-		Shader_setVec4(shader, "uHighlight", gMatState.xhighlight.r, gMatState.xhighlight.g, gMatState.xhighlight.b, gMatState.xhighlight.factor);
-		Shader_setVec4(shader, "uEnvColor", gMatState.env.r, gMatState.env.g, gMatState.env.b, gMatState.env.alpha);
-		Shader_setVec3(shader, "uFogColor", gFog.color[0], gFog.color[1], gFog.color[2]);
-		Shader_setVec2(shader, "uFog", gFog.fog[0], gFog.fog[1]);
-		Shader_setFloat(shader, "uK4", gMatState.k4);
-		Shader_setFloat(shader, "uK5", gMatState.k5);
-		Shader_setFloat(shader, "uLodFrac", gMatState.lodfrac);
-		Shader_setFloat(shader, "uPrimLodFrac", gMatState.prim.lodfrac);
-		Shader_setInt(shader, "texture0", 0);
-		Shader_setInt(shader, "texture1", 1);
-	}
-}
-
-static inline void TryMtlReady(void *cmd) __attribute__((always_inline));
-static inline void TryMtlReady(void *cmd)
+		gBackend->shader_vec4(shader, "uPrimColor", gMatState.prim.r, gMatState.prim.g, gMatState.prim.b, gMatState.prim.alpha);
+		gBackend->shader_vec4(shader, "uHighlight", gMatState.xhighlight.r, gMatState.xhighlight.g, gMatState.xhighlight.b, gMatState.xhighlight.factor);
+		gBackend->shader_vec4(shader, "uEnvColor", gMatState.env.r, gMatState.env.g, gMatState.env.b, gMatState.env.alpha);
+		gBackend->shader_vec3(shader, "uFogColor", gFog.color[0], gFog.color[1], gFog.color[2]);
+		gBackend->shader_vec2(shader, "uFog", gFog.fog[0], gFog.fog[1]);
+		gBackend->shader_float(shader, "uK4", gMatState.k4);
+		gBackend->shader_float(shader, "uK5", gMatState.k5);
+		gBackend->shader_float(shader, "uLodFrac", gMatState.lodfrac);
+		gBackend->shader_float(shader, "uPrimLodFrac", gMatState.prim.lodfrac);
+		gBackend->shader_int(shader, "texture0", 0);
+		gBackend->shader_int(shader, "texture1", 1);
+	}
+}
+
+static inline void TryMtlReady(void) __attribute__((always_inline));
+static inline void TryMtlReady(void)
 {
 	if (!gMatState.mtlReady)
 	{
 		gMatState.mtlReady = 1;
-		do_mtl(cmd);
+		if (sStatsEnabled) {
+			uint64_t start = stats_clock();
+			
+			do_mtl();
+			sStats.mtlCycles += stats_clock() - start;
+			sStats.mtlCount += 1;
+		} else
+			do_mtl();
 		
 		// TODO optimize: create gShaderUniforms instead of looking up by string each time
-		Shader_setVec4(gShader, "uMultiplyTexCoord",
+		gBackend->shader_vec4(gShader, "uMultiplyTexCoord",
 			Textures(0).TextureWRatio, Textures(0).TextureHRatio,
 			Textures(1).TextureWRatio, Textures(1).TextureHRatio
 		);
-		Shader_setVec4(gShader, "uShiftTexCoord",
+		gBackend->shader_vec4(gShader, "uShiftTexCoord",
 			(Textures(0).ULS / 128.0f) / (Textures(0).RealWidth  / 32.0f),
 			(Textures(0).ULT / 128.0f) / (Textures(0).RealHeight / 32.0f),
 			(Textures(1).ULS / 128.0f) / (Textures(1).RealWidth  / 32.0f),
@@ -1184,57 +1581,134 @@ static float shift_to_multiplier(const int shift) {
 	return pow(2, 16 - shift);
 }
 
-static N64Vector4 light_bind(N64Vector3 vtxPos, N64Vector3 vtxNor, int i) {
-	GbiLight* light = &sLights.l[i];
+/* std140 layout of the N64Lights block in lit vertex shaders */
+typedef struct {
+	float   ambient[4];
+	float   dir[7][4];
+	float   color[7][4];
+	float   pos[7][4];   /* point lights; w is how far they reach */
+	float   atten[7][4]; /* point lights; constant, linear, quadratic, 1 */
+	int32_t num[4];
+} LightBlock;
+
+static LightBlock sLightBlock;
+static uint8_t sLightPoints; /* which of sLightBlock are point lights */
+
+/* distance past which a point light adds less than 1/255 of its color */
+static float light_reach(const float atten[4]) {
+	float a = atten[2];
+	float b = atten[1];
+	float c = atten[0] - 255;
+	
+	if (c >= 0)
+		return 0;
+	if (a > 0)
+		return (-b + sqrtf(b * b - 4 * a * c)) / (2 * a);
+	if (b > 0)
+		return -c / b;
 	
-	if (light->dir.pad1 == 0) {
-		GbiLightDir* dir = &light->dir;
-		N64Vector3 onrm;
-		onrm.x = (float)dir->dir[0] / __INT8_MAX__;
-		onrm.y = (float)dir->dir[1] / __INT8_MAX__;
-		onrm.z = (float)dir->dir[2] / __INT8_MAX__;
+	return 1e18f; /* not attenuated */
+}
+
+/* lights only change between display lists, so they are uploaded once
+ * for all shaders instead of being evaluated per vertex */
+static void lights_upload(void) {
+	LightBlock* block = &sLightBlock;
+	
+	if (!sLightsDirty)
+		return;
+	sLightsDirty = false;
+	
+	memset(block, 0, sizeof(*block));
+	block->ambient[0] = sLights.a.l.col[0] / 255.0f;
+	block->ambient[1] = sLights.a.l.col[1] / 255.0f;
+	block->ambient[2] = sLights.a.l.col[2] / 255.0f;
+	block->num[0] = sLightNum;
+	sLightPoints = 0;
+	
+	for (int i = 0; i < sLightNum; i++) {
+		GbiLightDir* dir = &sLights.l[i].dir;
+		GbiLightPoint* point = &sLights.l[i].point;
+		N64Vector3 norm;
 		
-		// Directional light
-		N64Vector4 col = vec4_color(dir->col);
-		N64Vector3 norm = vec3_normalize(onrm);
-		float mod = N64_CLAMP(vec3_dot(vtxNor, norm), 0.0, 1.0);
+		block->color[i][0] = dir->col[0] / 255.0f;
+		block->color[i][1] = dir->col[1] / 255.0f;
+		block->color[i][2] = dir->col[2] / 255.0f;
 		
-		col.x *= mod;
-		col.y *= mod;
-		col.z *= mod;
+		/* point lights use the F3DEX2 attenuation,
+		 * 1 / (c / 16 + l * d / 65535 + q / 8 * d^2 / 65535) */
+		if (point->c != 0) {
+			block->atten[i][0] = (uint8_t)point->c / 16.0f;
+			block->atten[i][1] = (uint8_t)point->l / 65535.0f;
+			block->atten[i][2] = (uint8_t)point->q / 8.0f / 65535.0f;
+			block->atten[i][3] = 1;
+			block->pos[i][0] = point->pos[0];
+			block->pos[i][1] = point->pos[1];
+			block->pos[i][2] = point->pos[2];
+			block->pos[i][3] = light_reach(block->atten[i]);
+			sLightPoints |= 1 << i;
+			continue;
+		}
 		
-		return col;
-	} else {
-		// GbiLightPoint* point = &light->point;
+		norm.x = (float)dir->dir[0] / __INT8_MAX__;
+		norm.y = (float)dir->dir[1] / __INT8_MAX__;
+		norm.z = (float)dir->dir[2] / __INT8_MAX__;
+		norm = vec3_normalize(norm);
+		
+		block->dir[i][0] = norm.x;
+		block->dir[i][1] = norm.y;
+		block->dir[i][2] = norm.z;
 	}
 	
-	return (N64Vector4) { 0 };
+	gBackend->uniform_block(0, block, sizeof(*block));
 }
 
-static N64Vector4 light_bind_all(N64Vector3 vtxPos, N64Vector3 vtxNor) {
-	N64Vector4 final = {
-		sLights.a.l.col[0] / 255.0f,
-		sLights.a.l.col[1] / 255.0f,
-		sLights.a.l.col[2] / 255.0f,
-		1.0f
-	};
+static void outline_add(const uint8_t* indices, uint32_t num) {
+	bool culled = gMatState.geometrymode & (G_CULL_FRONT | G_CULL_BACK);
+	OutlineList* list = &sOutline[!culled];
 	
-	for (int i = 0; i < sLightNum; i++)	{
-		N64Vector4 color = light_bind(vtxPos, vtxNor, i);
-		final.x += color.x;
-		final.y += color.y;
-		final.z += color.z;
+	if (list->num + num > list->max) {
+		while (list->num + num > list->max)
+			list->max = list->max ? list->max * 2 : 1024;
+		
+		list->vtx = realloc(list->vtx, sizeof(*list->vtx) * list->max);
+		assert(list->vtx);
 	}
 	
-	final.x = N64_CLAMP(final.x, 0.0f, 1.0f);
-	final.y = N64_CLAMP(final.y, 0.0f, 1.0f);
-	final.z = N64_CLAMP(final.z, 0.0f, 1.0f);
-	
-	return final;
+	for (uint32_t i = 0; i < num; ++i)
+		list->vtx[list->num++] = sVbuf[indices[i]];
+}
+
+/* positions of every vertex the batch uses, one array per axis */
+static void tri_batch_gather(float* x, float* y, float* z) {
+	uint32_t i = 0;
+	
+#ifdef __SSE2__
+	for (; i + 4 <= gIndicesUsed; i += 4) {
+		__m128 a = _mm_loadu_ps(&sVbuf[gIndices[i + 0]].pos.x);
+		__m128 b = _mm_loadu_ps(&sVbuf[gIndices[i + 1]].pos.x);
+		__m128 c = _mm_loadu_ps(&sVbuf[gIndices[i + 2]].pos.x);
+		__m128 d = _mm_loadu_ps(&sVbuf[gIndices[i + 3]].pos.x);
+		
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		_mm_storeu_ps(x + i, a);
+		_mm_storeu_ps(y + i, b);
+		_mm_storeu_ps(z + i, c);
+	}
+#endif
+	for (; i < gIndicesUsed; ++i) {
+		const N64Vector4* pos = &sVbuf[gIndices[i]].pos;
+		
+		x[i] = pos->x;
+		y[i] = pos->y;
+		z[i] = pos->z;
+	}
 }
 
-static void try_draw_tri_batch(const uint8_t* b) {
-	if (!( (b[8] != G_TRI1 && b[8] != G_TRI2 && b[8] != G_QUAD) || gIndicesUsed + 6 >= N64_ARRAY_COUNT(gIndices) ))
+static void try_draw_tri_batch(const GbiCmd* cmd) {
+	uint8_t next = GBICMD_OP(cmd + 1);
+	
+	if (!( (next != G_TRI1 && next != G_TRI2 && next != G_QUAD) || gIndicesUsed + 6 >= N64_ARRAY_COUNT(gIndices) ))
 		return;
 	
 	if (s_tri_callback) {
@@ -1256,75 +1730,122 @@ static void try_draw_tri_batch(const uint8_t* b) {
 		}
 	}
 	
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gEBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(*gIndices) * gIndicesUsed, gIndices, GL_DYNAMIC_DRAW);
+	if (s_tri_batch_callback && gIndicesUsed) {
+		float* x = sTriBatchPos[0];
+		float* y = sTriBatchPos[1];
+		float* z = sTriBatchPos[2];
+		N64TriBatch batch = {
+			x, y, z,
+			gIndicesUsed / 3,
+			{
+				(gMatState.geometrymode & G_CULL_BACK),
+				(gMatState.geometrymode & G_CULL_FRONT),
+			},
+			.setId = gSetId
+		};
+		
+		tri_batch_gather(x, y, z);
+		s_tri_batch_callback(s_tri_batch_callback_data, &batch);
+	}
 	
-	#if 0 // wireframe method
-		if (gGxOutline) {
-			Shader_use(sOutlineShader);
-			Shader_setMat4(sOutlineShader, "view", &gMatrix.view);
-			Shader_setMat4(sOutlineShader, "projection", &gMatrix.projection);
-			
-			glEnable(GL_POLYGON_OFFSET_LINE);
-			glPolygonOffset(10, 10);
-			
-			Shader_setVec4(sOutlineShader, "color", 1, 0.5, 0, 1);
-			glLineWidth(5);
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			glDrawElements(GL_TRIANGLES, gIndicesUsed, GL_UNSIGNED_BYTE, 0);
-			
-			glPolygonOffset(gPolygonOffset, gPolygonOffset);
-			glDisable(GL_POLYGON_OFFSET_LINE);
-			
-			glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
-			Shader_use(gShader);
-		}
-	#else // inverse hull method
-		if (gGxOutline) {
-			GLint OldCullMode;
-			GLboolean OldCullBool;
-			GLboolean OldDepthBool;
-			GLboolean OldBlendBool;
-			
-			Shader_use(sOutlineShader);
-			Shader_setMat4(sOutlineShader, "view", &gMatrix.view);
-			Shader_setMat4(sOutlineShader, "projection", &gMatrix.projection);
-			
-			glGetIntegerv(GL_CULL_FACE_MODE, &OldCullMode);
-			glGetBooleanv(GL_CULL_FACE, &OldCullBool);
-			glGetBooleanv(GL_DEPTH_TEST, &OldDepthBool);
-			glGetBooleanv(GL_BLEND, &OldBlendBool);
-			
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-			
-			if (OldCullBool)
-				glEnable(GL_CULL_FACE);
-			glCullFace(GL_FRONT);
-			glDisable(GL_DEPTH_TEST); // comment this line to disable x-ray mode
-			
-			//Shader_setVec4(sOutlineShader, "color", 1, 0.5, 0, 1); // opaque orange
-			Shader_setVec4(sOutlineShader, "color", 1, 0.5, 0, 0.5); // translucent orange
-			
-			glDrawElements(GL_TRIANGLES, gIndicesUsed, GL_UNSIGNED_BYTE, 0);
-			
-			Shader_use(gShader);
-			
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-			glCullFace(OldCullMode);
-			if (!OldBlendBool)
-				glDisable(GL_BLEND);
-			if (!OldCullBool)
-				glDisable(GL_CULL_FACE);
-			if (OldDepthBool)
-				glEnable(GL_DEPTH_TEST);
-		}
-	#endif
+	/* inverse hull outlines are drawn later, in a pass of their own */
+	if (gGxOutline)
+		outline_add(gIndices, gIndicesUsed);
+	
+	/* a point light is skipped when no batch the triangles use is in its reach */
+	if (sLightPoints && !gVertexColors) {
+		uint8_t cull = sLightPoints;
+		
+		for (uint32_t i = 0; i < gIndicesUsed; i++)
+			cull &= sVbufCull[gIndices[i]];
+		gBackend->shader_int(gShader, "uLightCull", cull);
+	}
 	
-	glDrawElements(GL_TRIANGLES, gIndicesUsed, GL_UNSIGNED_BYTE, 0);
+	gBackend->draw_triangles(gIndices, gIndicesUsed);
 	gIndicesUsed = 0;
 }
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* render state is only passed on to the backend when it changes; what
+ * the backend has is forgotten at the start of each n64_draw_dlist(),
+ * since the host is free to change it between display lists */
+enum StateFlag {
+	STATE_BLEND,
+	STATE_DEPTH_TEST,
+	STATE_DEPTH_MASK,
+	STATE_OFFSET_FILL,
+	STATE_OFFSET_LINE,
+	STATE_WIREFRAME,
+	STATE_STENCIL,
+	STATE_CULL,
+	STATE_OFFSET
+};
+
+static _Thread_local struct {
+	uint32_t     known; /* 1 << StateFlag */
+	bool         flag[STATE_CULL];
+	enum N64Cull cull;
+	float        offset[2];
+} sState;
+
+static inline bool state_elide(enum StateFlag which, bool same) {
+	if (sStatsEnabled)
+		sStats.stateCalls += 1;
+	
+	if ((sState.known & (1 << which)) && same) {
+		if (sStatsEnabled)
+			sStats.stateElided += 1;
+		
+		return true;
+	}
+	
+	sState.known |= 1 << which;
+	
+	return false;
+}
+
+static void state_bool(enum StateFlag which, bool enable) {
+	if (state_elide(which, sState.flag[which] == enable))
+		return;
+	
+	sState.flag[which] = enable;
+	
+	switch (which) {
+		case STATE_BLEND: gBackend->blend(enable); break;
+		case STATE_DEPTH_TEST: gBackend->depth_test(enable); break;
+		case STATE_DEPTH_MASK: gBackend->depth_mask(enable); break;
+		case STATE_OFFSET_FILL: gBackend->polygon_offset_fill(enable); break;
+		case STATE_OFFSET_LINE: gBackend->polygon_offset_line(enable); break;
+		case STATE_WIREFRAME: gBackend->wireframe(enable); break;
+		case STATE_STENCIL: gBackend->stencil(enable); break;
+		default: assert(0 && "not a boolean state"); break;
+	}
+}
+
+static void state_cull(enum N64Cull mode) {
+	if (state_elide(STATE_CULL, sState.cull == mode))
+		return;
+	
+	sState.cull = mode;
+	gBackend->cull(mode);
+}
+
+static void state_polygon_offset(float factor, float units) {
+	if (state_elide(STATE_OFFSET, sState.offset[0] == factor && sState.offset[1] == units))
+		return;
+	
+	sState.offset[0] = factor;
+	sState.offset[1] = units;
+	gBackend->polygon_offset(factor, units);
+}
+
+static void state_forget(void) {
+	sState.known = 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
 static void othermode(void) {
 	///////// PARAMETER ////////////////// PPPP AAAA MMMM BBBB
 	#define G_RM_CYCLE1_MASK 0xCCCC0000 // 1100 1100 1100 1100
@@ -1357,24 +1878,19 @@ static void othermode(void) {
 	
 	switch (hi & (0b11 << G_MDSFT_TEXTFILT)) {
 		case G_TF_POINT:
-			gFilterMode = GL_NEAREST;
+			gFilterMode = N64_FILTER_NEAREST;
 			break;
 			
 		case G_TF_BILERP:
 		case G_TF_AVERAGE:
-			gFilterMode = GL_LINEAR;
+			gFilterMode = N64_FILTER_LINEAR;
 			break;
 	}
 	
-	if (gForceBl == true) {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	} else {                   /* false */
-		glDisable(GL_BLEND);
-	}
+	state_bool(STATE_BLEND, gForceBl);
 	
 	// fixes overlapping transparency where used (uncommon)
-	glDepthMask(!(!gCvgXalpha && gForceBl));
+	state_bool(STATE_DEPTH_MASK, !(!gCvgXalpha && gForceBl));
 	
 	gHideGeometry = false;
 	if (gOnlyThisZmode != N64_ZMODE_ALL && !(gOnlyThisZmode & gCurrentZmode))
@@ -1401,120 +1917,233 @@ static void othermode(void) {
 	/* hack for eliminating z-fighting on decals */
 	switch (gCurrentZmode) {
 		case N64_ZMODE_DEC: /* ZMODE_DEC */
-			glEnable(GL_POLYGON_OFFSET_FILL);
+			state_bool(STATE_OFFSET_FILL, true);
 			gPolygonOffset = -1;
 			break;
 		default:
-			glDisable(GL_POLYGON_OFFSET_FILL);
+			state_bool(STATE_OFFSET_FILL, false);
 			gPolygonOffset = 0;
 			break;
 	}
 	
-	glPolygonOffset(gPolygonOffset, gPolygonOffset);
+	state_polygon_offset(gPolygonOffset, gPolygonOffset);
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-static bool gbiFunc_vtx(void* cmd) {
-	uint8_t* b = cmd;
-	
-	int numv = (b[1] << 4) | (b[2] >> 4);
-	int vbidx = (b[3] >> 1) - numv;
-	GbiVtx* vtx = n64_segment_get(u32r(b + 4));
-	N64Vtx* dst = sVbuf + vbidx;
-	
-	TryMtlReady(cmd);
-	
-	if (gHideGeometry)
-		return false;
-	
-	for (; numv--; dst++, vtx++) {
-		dst->pos.x = vtx->x;
-		dst->pos.y = vtx->y;
-		dst->pos.z = vtx->z;
+/* positions go straight into the vertex buffer; normals, when asked for,
+ * come out in world space and normalized, as lighting and outlines use them */
+static void vtx_transform_scalar(const GbiVtx* vtx, N64Vtx* dst, N64Vector3* norm, int num, Mtx* mf) {
+	for (; num--; dst++, vtx++) {
+		N64Vector3 modelPos = { vtx->x, vtx->y, vtx->z };
 		
-		N64Vector3 modelPos = { dst->pos.x, dst->pos.y, dst->pos.z };
+		mtx_mul_vec4(&modelPos, &dst->pos, mf);
 		
-		mtx_mul_vec4(&modelPos, &dst->pos, gMatrix.modelNow);
+		if (norm) {
+			N64Vector3 nrm = { UNFOLD_VEC3_EXT(vtx->normal, * (1.0 / 127.0)) };
+			N64Vector3 global_normal;
+			
+			mtx_mul_vec3_rot(&nrm, &global_normal, mf);
+			*norm++ = vec3_normalize(global_normal);
+		}
+	}
+}
+
+#ifdef __SSE2__
+
+/* big-endian int16 from bytes 0-1 and 2-3 of each lane */
+#define VTX_S16_LO(v) _mm_or_si128(_mm_srai_epi32(_mm_slli_epi32(v, 24), 16), _mm_and_si128(_mm_srli_epi32(v, 8), _mm_set1_epi32(0xff)))
+#define VTX_S16_HI(v) _mm_or_si128(_mm_andnot_si128(_mm_set1_epi32(0xff), _mm_srai_epi32(_mm_slli_epi32(v, 8), 16)), _mm_srli_epi32(v, 24))
+/* int8 from byte n of each lane */
+#define VTX_S8(v, n)  _mm_srai_epi32(_mm_slli_epi32(v, 24 - (n) * 8), 24)
+
+/* four at a time, in the same order of operations as mtx_mul_vec4() and
+ * vec3_normalize(), so the results match the scalar path exactly */
+static void vtx_transform(const GbiVtx* vtx, N64Vtx* dst, N64Vector3* norm, int num, Mtx* mf) {
+	const __m128 scale = _mm_set1_ps(127.0f);
+	const __m128 zero = _mm_setzero_ps();
+	
+	for (; num >= 4; num -= 4, vtx += 4, dst += 4) {
+		const uint8_t* src = (const void*)vtx;
+		__m128i v0 = _mm_loadu_si128((const void*)(src + 0x00));
+		__m128i v1 = _mm_loadu_si128((const void*)(src + 0x10));
+		__m128i v2 = _mm_loadu_si128((const void*)(src + 0x20));
+		__m128i v3 = _mm_loadu_si128((const void*)(src + 0x30));
+		__m128i lo01 = _mm_unpacklo_epi32(v0, v1);
+		__m128i lo23 = _mm_unpacklo_epi32(v2, v3);
+		__m128i w0 = _mm_unpacklo_epi64(lo01, lo23); /* x, y */
+		__m128i w1 = _mm_unpackhi_epi64(lo01, lo23); /* z, flag */
+		__m128 x = _mm_cvtepi32_ps(VTX_S16_LO(w0));
+		__m128 y = _mm_cvtepi32_ps(VTX_S16_HI(w0));
+		__m128 z = _mm_cvtepi32_ps(VTX_S16_LO(w1));
+		__m128 px, py, pz, pw;
 		
-	#ifdef RENDERHOOK_UOT
-		// XXX moved the multiplication into the shader (uMultiplyTexCoord)
-		dst->texcoord0.u = vtx->u;
-		dst->texcoord0.v = vtx->v;
-		dst->texcoord1.u = vtx->u;
-		dst->texcoord1.v = vtx->v;
-		/* // the math that was moved into the shader:
-		dst->texcoord0.u = vtx->u * Textures(0).TextureWRatio;
-		dst->texcoord0.v = vtx->v * Textures(0).TextureHRatio;
-		dst->texcoord1.u = vtx->u * Textures(1).TextureWRatio;
-		dst->texcoord1.v = vtx->v * Textures(1).TextureHRatio;
-		*/
+		#define VTX_ROW(w, a, b, c) \
+			_mm_add_ps(_mm_set1_ps(mf->w), _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mf->a), x), _mm_mul_ps(_mm_set1_ps(mf->b), y)), _mm_mul_ps(_mm_set1_ps(mf->c), z)))
+		px = VTX_ROW(xw, xx, xy, xz);
+		py = VTX_ROW(yw, yx, yy, yz);
+		pz = VTX_ROW(zw, zx, zy, zz);
+		pw = VTX_ROW(ww, wx, wy, wz);
+		#undef VTX_ROW
 		
-		// https://github.com/z64me/zzviewer-rrw
-		// TODO texgen uses hard-coded texture sizes
-		// TODO use more accurate method (this code only approximates texgen uv's)
-		if (gMatState.texgen)
-		{
-			N64Vector3 norm;
-			// GL_EYE_LINEAR
-		#if 0
-			// try doing some texgen stuff
-			/* zzviewer-rrw code, for reference
-			vec4 V = vec4_transform(ctx->modelview, vert->pos);
-			struct vec4 e = vec4_normalize3(&V);
-			struct vec4 n = vec4_transform(ctx->projection, vert->col);
-			vec4_normalize3_inplace(&n);
+		_MM_TRANSPOSE4_PS(px, py, pz, pw);
+		_mm_storeu_ps(&dst[0].pos.x, px);
+		_mm_storeu_ps(&dst[1].pos.x, py);
+		_mm_storeu_ps(&dst[2].pos.x, pz);
+		_mm_storeu_ps(&dst[3].pos.x, pw);
+		
+		if (norm) {
+			__m128i w3 = _mm_unpackhi_epi64(_mm_unpackhi_epi32(v0, v1), _mm_unpackhi_epi32(v2, v3));
+			__m128 nx = _mm_div_ps(_mm_cvtepi32_ps(VTX_S8(w3, 0)), scale);
+			__m128 ny = _mm_div_ps(_mm_cvtepi32_ps(VTX_S8(w3, 1)), scale);
+			__m128 nz = _mm_div_ps(_mm_cvtepi32_ps(VTX_S8(w3, 2)), scale);
+			__m128 gx, gy, gz, mgn, nonzero;
 			
-			struct vec4 r = reflect(&e, &n);
-			float m = 2 * sqrt(r.x*r.x + r.y*r.y + (r.z+1)*(r.z+1));
-			vert->uv.x = r.x / m + 0.5f;
-			vert->uv.y = r.y / m + 0.5f;
-			vert->uv.x *= 16;
-			vert->uv.y *= 16;
-			*/
-		#endif
-			/* zzviewer-rrw
-			struct vec4 n = vec4_transform(ctx->normalmatrix, vert->norm);
-			vec4_normalize3_inplace(&n);
-			vert->uv.x = (n.x + 1) / 2;
-			vert->uv.y = (n.y + 1) / 2;
-			*/
-			{
-				norm = (N64Vector3){ UNFOLD_VEC3_EXT(vtx->normal, * (1.0 / 127.0)) };
-				norm = mtx_mul_vec3(norm, &gMatrix.normal);
-				norm = vec3_normalize(norm);
-			}
-		#if 0 // linear?
-			//vec4_normalize2_inplace(&n);
-			norm.x = acos(norm.x);
-			norm.y = acos(norm.y);
-		#endif
-			/* zzviewer-rrw
-			// TODO 8 or 16? likely varies with texture dimensions...
-			norm.x *= 16;
-			norm.y *= 16;
-			*/
-			// zzviewer-rrw multiplied a value, not necessary here?
+			#define VTX_ROT(a, b, c) \
+				_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mf->a), nx), _mm_mul_ps(_mm_set1_ps(mf->b), ny)), _mm_mul_ps(_mm_set1_ps(mf->c), nz))
+			gx = VTX_ROT(xx, xy, xz);
+			gy = VTX_ROT(yx, yy, yz);
+			gz = VTX_ROT(zx, zy, zz);
+			#undef VTX_ROT
 			
-			// approximate spherical
-			//norm.x /= 8;
-			//norm.y /= 8;
+			mgn = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_mul_ps(gz, gz)));
+			nonzero = _mm_cmpneq_ps(mgn, zero);
+			gx = _mm_and_ps(_mm_div_ps(gx, mgn), nonzero);
+			gy = _mm_and_ps(_mm_div_ps(gy, mgn), nonzero);
+			gz = _mm_and_ps(_mm_div_ps(gz, mgn), nonzero);
 			
-			// apply to uv's
-			dst->texcoord0.u = norm.x;
-			dst->texcoord0.v = norm.y;
-			dst->texcoord1.u = norm.x;
-			dst->texcoord1.v = norm.y;
+			_MM_TRANSPOSE4_PS(gx, gy, gz, mgn);
+			memcpy(&norm[0], &gx, sizeof(*norm));
+			memcpy(&norm[1], &gy, sizeof(*norm));
+			memcpy(&norm[2], &gz, sizeof(*norm));
+			memcpy(&norm[3], &mgn, sizeof(*norm));
+			norm += 4;
+		}
+	}
+	
+	vtx_transform_scalar(vtx, dst, norm, num, mf);
+}
+
+#undef VTX_S16_LO
+#undef VTX_S16_HI
+#undef VTX_S8
+
+#else
+	#define vtx_transform vtx_transform_scalar
+#endif
+
+/* marks the point lights that cannot reach any vertex of a batch,
+ * testing the light's reach against the batch's bounding sphere */
+static void vtx_cull_lights(const N64Vtx* vtx, int vbidx, int num) {
+	float lo[4], hi[4], center[3], radius;
+	uint8_t cull = 0;
+	
+	if (!sLightPoints || num <= 0)
+		return;
+
+#ifdef __SSE2__
+	{
+		__m128 vlo = _mm_loadu_ps(&vtx->pos.x);
+		__m128 vhi = vlo;
+		
+		for (int i = 1; i < num; i++) {
+			__m128 p = _mm_loadu_ps(&vtx[i].pos.x);
 			
-			// shader multiplies by these, so divide here to counteract that
-			// TODO texgen textures can also scroll, so need hack for that too
-			dst->texcoord0.u /= Textures(0).TextureWRatio;
-			dst->texcoord0.v /= Textures(0).TextureHRatio;
-			dst->texcoord1.u /= Textures(1).TextureWRatio;
-			dst->texcoord1.v /= Textures(1).TextureHRatio;
+			vlo = _mm_min_ps(vlo, p);
+			vhi = _mm_max_ps(vhi, p);
 		}
+		_mm_storeu_ps(lo, vlo);
+		_mm_storeu_ps(hi, vhi);
+	}
+#else
+	memcpy(lo, &vtx->pos.x, sizeof(lo));
+	memcpy(hi, &vtx->pos.x, sizeof(hi));
+	for (int i = 1; i < num; i++) {
+		const float* p = &vtx[i].pos.x;
 		
-		// scrolling textures
+		for (int k = 0; k < 3; k++) {
+			lo[k] = fminf(lo[k], p[k]);
+			hi[k] = fmaxf(hi[k], p[k]);
+		}
+	}
+#endif
+
+	for (int k = 0; k < 3; k++)
+		center[k] = (lo[k] + hi[k]) * 0.5f;
+	radius = sqrtf(
+		(hi[0] - lo[0]) * (hi[0] - lo[0]) +
+		(hi[1] - lo[1]) * (hi[1] - lo[1]) +
+		(hi[2] - lo[2]) * (hi[2] - lo[2])
+	) * 0.5f;
+	
+	for (int i = 0; i < sLightNum; i++) {
+		const float* pos = sLightBlock.pos[i];
+		float dx = pos[0] - center[0];
+		float dy = pos[1] - center[1];
+		float dz = pos[2] - center[2];
+		float reach = pos[3] + radius;
+		
+		if ((sLightPoints & (1 << i)) && dx * dx + dy * dy + dz * dz > reach * reach)
+			cull |= 1 << i;
+	}
+	
+	memset(sVbufCull + vbidx, cull, num);
+}
+
+static bool gbiFunc_vtx(const GbiCmd* cmd) {
+	int numv = (cmd->w0 >> 12) & 0xff;
+	int vbidx = ((cmd->w0 & 0xff) >> 1) - numv;
+	GbiVtx* vtx = cmd_segment(cmd);
+	N64Vtx* dst = sVbuf + vbidx;
+	N64Vector3 normals[N64_VBUF_MAX];
+	N64Vector3* norm = normals;
+	GbiVtx* src = vtx;
+	N64Vtx* out = dst;
+	int num = numv;
+	bool cacheable;
+	uint32_t hash;
+	VtxKey key;
+	
+	TryMtlReady();
+	
+	if (gHideGeometry) {
+		memset(sVbufLoaded + vbidx, 0, numv);
+		return false;
+	}
+	memset(sVbufLoaded + vbidx, 1, numv);
+	
+	if (sStatsEnabled)
+		sStats.vertices += numv;
+	trace_touch((const void*)vtx, sizeof(*vtx) * numv);
+	
+	if ((cacheable = vtxcache_key((const void*)vtx, &key, &hash))) {
+		const VtxCache* cached = vtxcache_get((const void*)vtx, numv, &key, hash);
+		
+		if (cached) {
+			memcpy(dst, cached->vtx, sizeof(*dst) * numv);
+			goto L_upload;
+		}
+	}
+	
+	vtx_transform(vtx, dst, (!gVertexColors || gGxOutline || gMatState.texgen) ? normals : 0, numv, gMatrix.modelNow);
+	
+	for (; numv--; dst++, vtx++, norm++) {
+	#ifdef RENDERHOOK_UOT
+		// XXX moved the multiplication into the shader (uMultiplyTexCoord)
+		dst->texcoord0.u = vtx->u;
+		dst->texcoord0.v = vtx->v;
+		dst->texcoord1.u = vtx->u;
+		dst->texcoord1.v = vtx->v;
+		/* // the math that was moved into the shader:
+		dst->texcoord0.u = vtx->u * Textures(0).TextureWRatio;
+		dst->texcoord0.v = vtx->v * Textures(0).TextureHRatio;
+		dst->texcoord1.u = vtx->u * Textures(1).TextureWRatio;
+		dst->texcoord1.v = vtx->v * Textures(1).TextureHRatio;
+		*/
+		
+		// texgen replaces these in the vertex shader (see texcoords())
+		
+		// scrolling textures
 		// TODO make not hard-coded
 		// XXX moved this math into shader (uShiftTexCoord)
 		/*
@@ -1545,95 +2174,159 @@ static bool gbiFunc_vtx(void* cmd) {
 			dst->color.y = vtx->color.g * (1.0 / 255.0);
 			dst->color.z = vtx->color.b * (1.0 / 255.0);
 			
-			// normals still required for inverse hull
-			if (gGxOutline) {
-				N64Vector3 global_normal;
-				dst->norm.x = vtx->normal.x * (1.0 / 127.0);
-				dst->norm.y = vtx->normal.y * (1.0 / 127.0);
-				dst->norm.z = vtx->normal.z * (1.0 / 127.0);
-				
-				mtx_mul_vec3_rot(&dst->norm, &global_normal, gMatrix.modelNow);
-				dst->norm = vec3_normalize(global_normal);
-			}
+			// normals still required for inverse hull and texgen
+			if (gGxOutline || gMatState.texgen)
+				dst->norm = *norm;
 		} else {
-			N64Vector3 global_normal;
-			dst->norm.x = vtx->normal.x * (1.0 / 127.0);
-			dst->norm.y = vtx->normal.y * (1.0 / 127.0);
-			dst->norm.z = vtx->normal.z * (1.0 / 127.0);
-			
-			mtx_mul_vec3_rot(&dst->norm, &global_normal, gMatrix.modelNow);
-			dst->color = light_bind_all(modelPos, vec3_normalize(global_normal));
+			/* lit by the vertex shader; the color bytes are the normal */
+			dst->color.x = dst->color.y = dst->color.z = 1.0f;
+			dst->norm = *norm;
 		}
 		
 		dst->color.w = vtx->color.a * (1.0 / 255.0);
 	}
 	
-	glBindBuffer(GL_ARRAY_BUFFER, gVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(sVbuf), sVbuf, GL_DYNAMIC_DRAW);
+	if (cacheable)
+		vtxcache_put((const void*)src, num, &key, hash, out);
+	
+L_upload:
+	vtx_cull_lights(out, out - sVbuf, num);
+	gBackend->vertices(sVbuf, N64_VBUF_MAX);
 	gIndicesUsed = 0;
 	
 	return false;
 }
 
-static bool gbiFunc_culldl(void* cmd) {
+/* the vertex buffer is already in world space, so only projection * view
+ * is left; a list is hidden when every one of its bounding vertices is
+ * outside the same clip plane */
+static bool cull_frustum(const N64Vtx* v, int num) {
+	const Mtx* m = &sCullMtx;
+	int out = 0x3f; /* planes all vertices so far are outside of */
+	
+#ifdef __SSE2__
+	for (; num >= 4 && out; num -= 4, v += 4) {
+		__m128 x = _mm_loadu_ps(&v[0].pos.x);
+		__m128 y = _mm_loadu_ps(&v[1].pos.x);
+		__m128 z = _mm_loadu_ps(&v[2].pos.x);
+		__m128 w = _mm_loadu_ps(&v[3].pos.x);
+		__m128 cx, cy, cz, cw, ncw;
+		
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		#define CULL_ROW(a, b, c, d) \
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m->a), x), _mm_mul_ps(_mm_set1_ps(m->b), y)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m->c), z), _mm_mul_ps(_mm_set1_ps(m->d), w)))
+		cx = CULL_ROW(xx, xy, xz, xw);
+		cy = CULL_ROW(yx, yy, yz, yw);
+		cz = CULL_ROW(zx, zy, zz, zw);
+		cw = CULL_ROW(wx, wy, wz, ww);
+		#undef CULL_ROW
+		ncw = _mm_sub_ps(_mm_setzero_ps(), cw);
+		
+		out &= (_mm_movemask_ps(_mm_cmplt_ps(cx, ncw)) == 0xf) << 0
+			| (_mm_movemask_ps(_mm_cmpgt_ps(cx, cw)) == 0xf) << 1
+			| (_mm_movemask_ps(_mm_cmplt_ps(cy, ncw)) == 0xf) << 2
+			| (_mm_movemask_ps(_mm_cmpgt_ps(cy, cw)) == 0xf) << 3
+			| (_mm_movemask_ps(_mm_cmplt_ps(cz, ncw)) == 0xf) << 4
+			| (_mm_movemask_ps(_mm_cmpgt_ps(cz, cw)) == 0xf) << 5;
+	}
+#endif
+	
+	for (; num > 0 && out; num--, v++) {
+		const N64Vector4* p = &v->pos;
+		float cx = m->xx * p->x + m->xy * p->y + m->xz * p->z + m->xw * p->w;
+		float cy = m->yx * p->x + m->yy * p->y + m->yz * p->z + m->yw * p->w;
+		float cz = m->zx * p->x + m->zy * p->y + m->zz * p->z + m->zw * p->w;
+		float cw = m->wx * p->x + m->wy * p->y + m->wz * p->z + m->ww * p->w;
+		
+		out &= (cx < -cw) << 0
+			| (cx > cw) << 1
+			| (cy < -cw) << 2
+			| (cy > cw) << 3
+			| (cz < -cw) << 4
+			| (cz > cw) << 5;
+	}
+	
+	return out != 0;
+}
+
+/* a cull callback takes the place of the built-in frustum test */
+static bool gbiFunc_culldl(const GbiCmd* cmd) {
 	if (s_cull_enabled == false)
 		return false;
 	
-	if (s_cull_callback == NULL)
+	int vfirst = (cmd->w0 & 0xffff) / 2;
+	int vlast = (cmd->w1 & 0xffff) / 2;
+	N64Vtx* v = sVbuf + vfirst;
+	bool culled;
+	
+	/* whatever is left in the vertex buffer says nothing about this list */
+	if (vlast >= N64_VBUF_MAX || vfirst > vlast)
 		return false;
+	for (int i = vfirst; i <= vlast; ++i) {
+		if (!sVbufLoaded[i])
+			return false;
+	}
 	
-	uint8_t* b = cmd;
-	int vfirst = u16r(b + 2) / 2;
-	int vlast = u16r(b + 6) / 2;
-	N64Vtx* v = sVbuf + vfirst;
+	if (s_cull_callback)
+		culled = s_cull_callback(s_cull_callback_data, (void*)v, vlast - vfirst + 1);
+	else if (sCullFrustum)
+		culled = cull_frustum(v, vlast - vfirst + 1);
+	else
+		return false;
 	
-	return s_cull_callback(s_cull_callback_data, (void*)v, vlast - vfirst + 1);
+	if (sStatsEnabled) {
+		if (culled)
+			sStats.cullRejected += 1;
+		else
+			sStats.cullAccepted += 1;
+	}
+	
+	return culled;
 }
 
-static bool gbiFunc_tri1(void* cmd) {
-	uint8_t* b = cmd;
+static bool gbiFunc_tri1(const GbiCmd* cmd) {
+	uint32_t w0 = cmd->w0;
 	
-	TryMtlReady(cmd);
+	TryMtlReady();
 	
 	if (gHideGeometry)
 		return false;
 	
-	gIndices[gIndicesUsed++] = b[1] / 2;
-	gIndices[gIndicesUsed++] = b[2] / 2;
-	gIndices[gIndicesUsed++] = b[3] / 2;
+	gIndices[gIndicesUsed++] = ((w0 >> 16) & 0xff) / 2;
+	gIndices[gIndicesUsed++] = ((w0 >> 8) & 0xff) / 2;
+	gIndices[gIndicesUsed++] = (w0 & 0xff) / 2;
 	
-	try_draw_tri_batch(b);
+	try_draw_tri_batch(cmd);
 	
 	return false;
 }
 
-static bool gbiFunc_tri2(void* cmd) {
-	uint8_t* b = cmd;
+static bool gbiFunc_tri2(const GbiCmd* cmd) {
+	uint32_t w0 = cmd->w0;
+	uint32_t w1 = cmd->w1;
 	
-	TryMtlReady(cmd);
+	TryMtlReady();
 	
 	if (gHideGeometry)
 		return false;
 	
-	gIndices[gIndicesUsed++] = b[1] / 2;
-	gIndices[gIndicesUsed++] = b[2] / 2;
-	gIndices[gIndicesUsed++] = b[3] / 2;
+	gIndices[gIndicesUsed++] = ((w0 >> 16) & 0xff) / 2;
+	gIndices[gIndicesUsed++] = ((w0 >> 8) & 0xff) / 2;
+	gIndices[gIndicesUsed++] = (w0 & 0xff) / 2;
 	
-	gIndices[gIndicesUsed++] = b[5] / 2;
-	gIndices[gIndicesUsed++] = b[6] / 2;
-	gIndices[gIndicesUsed++] = b[7] / 2;
+	gIndices[gIndicesUsed++] = ((w1 >> 16) & 0xff) / 2;
+	gIndices[gIndicesUsed++] = ((w1 >> 8) & 0xff) / 2;
+	gIndices[gIndicesUsed++] = (w1 & 0xff) / 2;
 	
-	try_draw_tri_batch(b);
+	try_draw_tri_batch(cmd);
 	
 	return false;
 }
 
-static bool gbiFunc_settimg(void* cmd) {
-	uint8_t* b = cmd;
-	uint8_t bits = b[1];
-	uint16_t hi = u16r(b + 2);
-	uint32_t lo = u32r(b + 4);
-	void* imgaddr = n64_segment_get(lo);
+static bool gbiFunc_settimg(const GbiCmd* cmd) {
+	uint8_t bits = (cmd->w0 >> 16) & 0xff;
+	uint16_t hi = cmd->w0 & 0xffff;
+	void* imgaddr = cmd_segment(cmd);
 	int fmt = bits >> 5;
 	int siz = (bits >> 3) & 3;
 	int width = hi + 1;
@@ -1648,9 +2341,8 @@ static bool gbiFunc_settimg(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_texture(void* cmd) {
-	uint8_t* b = cmd;
-	uint16_t bits = u16r(b + 2);
+static bool gbiFunc_texture(const GbiCmd* cmd) {
+	uint16_t bits = cmd->w0 & 0xffff;
 	int tile = (bits >> 8) & 7;
 	int level = (bits >> 11) & 7;
 	int on = bits & 0xfe;
@@ -1664,32 +2356,33 @@ static bool gbiFunc_texture(void* cmd) {
 		return false;
 	
 	gMatState.tile[tile].level = level;
-	gMatState.tile[tile].scaleS = u16r(b + 4) * (1.0f / UINT16_MAX);
-	gMatState.tile[tile].scaleT = u16r(b + 6) * (1.0f / UINT16_MAX);
+	gMatState.tile[tile].scaleS = (cmd->w1 >> 16) * (1.0f / UINT16_MAX);
+	gMatState.tile[tile].scaleT = (cmd->w1 & 0xffff) * (1.0f / UINT16_MAX);
 	
 	return false;
 }
 
-static bool gbiFunc_loadtlut(void* cmd) {
-	uint8_t* b = cmd;
-	// int t = b[4];
-	int c = (b[5] << 4) | (b[6] >> 4);
+static bool gbiFunc_loadtlut(const GbiCmd* cmd) {
+	// int t = cmd->w1 >> 24;
+	int c = (cmd->w1 >> 12) & 0xfff;
 	
 	if (!gMatState.timg.imgaddr)
 		return false;
 	
 	//fprintf(stderr, "loadtlut\n");
 	
-	memcpy(gMatState.pal, gMatState.timg.imgaddr, ((c >> 2) + 1) * sizeof(uint16_t));
+	if (sStatsEnabled)
+		stats_palette(gMatState.timg.imgaddr);
+	trace_touch(gMatState.timg.imgaddr, ((c >> 2) + 1) * sizeof(uint16_t));
+	palette_load(gMatState.timg.imgaddr, ((c >> 2) + 1) * sizeof(uint16_t));
 	
 	return false;
 }
 
-static bool gbiFunc_settilesize(void* cmd) {
-	uint8_t* b = cmd;
-	int i = b[4];
-	uint32_t hi = u32r(b);
-	uint32_t lo = u32r(b + 4);
+static bool gbiFunc_settilesize(const GbiCmd* cmd) {
+	uint32_t hi = cmd->w0;
+	uint32_t lo = cmd->w1;
+	int i = lo >> 24;
 	
 	if (i > 1)
 		return false;
@@ -1702,10 +2395,9 @@ static bool gbiFunc_settilesize(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_settile(void* cmd) {
-	uint8_t* b = cmd;
-	uint32_t hi = u32r(b);
-	uint32_t lo = u32r(b + 4);
+static bool gbiFunc_settile(const GbiCmd* cmd) {
+	uint32_t hi = cmd->w0;
+	uint32_t lo = cmd->w1;
 	
 	int fmt = (hi >> 21) & 7;
 	int siz = (hi >> 19) & 3;
@@ -1750,29 +2442,28 @@ static bool gbiFunc_settile(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_loadblock(void* cmd) {
+static bool gbiFunc_loadblock(const GbiCmd* cmd) {
 	return false;
 }
 
-static bool gbiFunc_loadtile(void* cmd) {
+static bool gbiFunc_loadtile(const GbiCmd* cmd) {
 	return false;
 }
 
-static bool gbiFunc_rdppipesync(void* cmd) {
+static bool gbiFunc_rdppipesync(const GbiCmd* cmd) {
 	gMatState.mtlReady = 0;
 	
 	return false;
 }
 
-static bool gbiFunc_enddl(void* cmd) {
+static bool gbiFunc_enddl(const GbiCmd* cmd) {
 	return true;
 }
 
-static bool gbiFunc_setothermode_l(void* cmd) {
-	uint8_t* b = cmd;
-	int ss = b[2];
-	int nn = b[3];
-	uint32_t data = u32r(b + 4);
+static bool gbiFunc_setothermode_l(const GbiCmd* cmd) {
+	int ss = (cmd->w0 >> 8) & 0xff;
+	int nn = cmd->w0 & 0xff;
+	uint32_t data = cmd->w1;
 	int shift = 32 - (nn + 1) - ss;
 	int length = nn + 1;
 	
@@ -1783,11 +2474,10 @@ static bool gbiFunc_setothermode_l(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_setothermode_h(void* cmd) {
-	uint8_t* b = cmd;
-	int ss = b[2];
-	int nn = b[3];
-	uint32_t data = u32r(b + 4);
+static bool gbiFunc_setothermode_h(const GbiCmd* cmd) {
+	int ss = (cmd->w0 >> 8) & 0xff;
+	int nn = cmd->w0 & 0xff;
+	uint32_t data = cmd->w1;
 	int shift = 32 - (nn + 1) - ss;
 	int length = nn + 1;
 	
@@ -1798,22 +2488,18 @@ static bool gbiFunc_setothermode_h(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_rdpsetothermode(void* cmd) {
-	uint8_t* b = cmd;
-	
-	gMatState.othermode_hi = u32r(b);
-	gMatState.othermode_lo = u32r(b + 4);
+static bool gbiFunc_rdpsetothermode(const GbiCmd* cmd) {
+	gMatState.othermode_hi = cmd->w0;
+	gMatState.othermode_lo = cmd->w1;
 	
 	othermode();
 	
 	return false;
 }
 
-static bool gbiFunc_setprimcolor(void* cmd) {
-	uint8_t* b = cmd;
-	
-	gMatState.prim.hi = u32r(b);
-	gMatState.prim.lo = u32r(b + 4);
+static bool gbiFunc_setprimcolor(const GbiCmd* cmd) {
+	gMatState.prim.hi = cmd->w0;
+	gMatState.prim.lo = cmd->w1;
 	
 	// update primcolor register in already-active shader
 	if (gMatState.mtlReady && gShader)
@@ -1822,20 +2508,18 @@ static bool gbiFunc_setprimcolor(void* cmd) {
 		gMatState.prim.g = ((gMatState.prim.lo >> 16) & 0xff) / 255.0f;
 		gMatState.prim.b = ((gMatState.prim.lo >> 8) & 0xff) / 255.0f;
 		gMatState.prim.alpha = (gMatState.prim.lo & 0xff) / 255.0f;
-		Shader_setVec4(gShader, "uPrimColor", gMatState.prim.r, gMatState.prim.g, gMatState.prim.b, gMatState.prim.alpha);
+		gBackend->shader_vec4(gShader, "uPrimColor", gMatState.prim.r, gMatState.prim.g, gMatState.prim.b, gMatState.prim.alpha);
 		
 		gMatState.prim.lodfrac = (gMatState.prim.hi & 0xff) / 255.0f;
-		Shader_setFloat(gShader, "uPrimLodFrac", gMatState.prim.lodfrac);
+		gBackend->shader_float(gShader, "uPrimLodFrac", gMatState.prim.lodfrac);
 	}
 	
 	return false;
 }
 
-static bool gbiFunc_setenvcolor(void* cmd) {
-	uint8_t* b = cmd;
-	
-	gMatState.env.hi = u32r(b);
-	gMatState.env.lo = u32r(b + 4);
+static bool gbiFunc_setenvcolor(const GbiCmd* cmd) {
+	gMatState.env.hi = cmd->w0;
+	gMatState.env.lo = cmd->w1;
 	
 	// update envcolor register in already-active shader
 	if (gMatState.mtlReady && gShader)
@@ -1845,68 +2529,65 @@ static bool gbiFunc_setenvcolor(void* cmd) {
 		gMatState.env.b = ((gMatState.env.lo >> 8) & 0xff) / 255.0f;
 		gMatState.env.alpha = (gMatState.env.lo & 0xff) / 255.0f;
 		
-		Shader_setVec4(gShader, "uEnvColor", gMatState.env.r, gMatState.env.g, gMatState.env.b, gMatState.env.alpha);
+		gBackend->shader_vec4(gShader, "uEnvColor", gMatState.env.r, gMatState.env.g, gMatState.env.b, gMatState.env.alpha);
 	}
 	
 	return false;
 }
 
-static bool gbiFunc_setcombine(void* cmd) {
-	uint8_t* b = cmd;
-	
-	gMatState.setcombine.hi = u32r(b);
-	gMatState.setcombine.lo = u32r(b + 4);
+static bool gbiFunc_setcombine(const GbiCmd* cmd) {
+	gMatState.setcombine.hi = cmd->w0;
+	gMatState.setcombine.lo = cmd->w1;
 	
 	return false;
 }
 
-static bool gbiFunc_geometrymode(void* cmd) {
-	uint8_t* b = cmd;
-	uint32_t clearbits = ~(u32r(b) & 0xffffff);
-	uint32_t setbits = u32r(b + 4);
+static bool gbiFunc_geometrymode(const GbiCmd* cmd) {
+	uint32_t clearbits = ~(cmd->w0 & 0xffffff);
+	uint32_t setbits = cmd->w1;
 	
 	gMatState.geometrymode = (gMatState.geometrymode & ~clearbits) | setbits;
 	
-	/* vertex colors */
-	if (clearbits & G_LIGHTING)
-		gVertexColors = 1;
-	if (setbits & G_LIGHTING)
-		gVertexColors = 0;
+	/* vertex colors; lighting picks a different shader */
+	if ((clearbits & G_LIGHTING) && !gVertexColors)
+		gVertexColors = 1, gMatState.mtlReady = 0;
+	if ((setbits & G_LIGHTING) && gVertexColors)
+		gVertexColors = 0, gMatState.mtlReady = 0;
 	if (clearbits & G_ZBUFFER)
-		glDisable(GL_DEPTH_TEST);
+		state_bool(STATE_DEPTH_TEST, false);
 	if (setbits & G_ZBUFFER)
-		glEnable(GL_DEPTH_TEST);
+		state_bool(STATE_DEPTH_TEST, true);
 	
-	// texgen
-	gMatState.texgen = (gMatState.geometrymode
+	// texgen, which also picks a different shader
+	unsigned texgen = (gMatState.geometrymode
 		& (N64_RSP_TEXTURE_GEN | N64_RSP_TEXTURE_GEN_LINEAR)
 	) >> 18;
+	if (texgen != gMatState.texgen)
+		gMatState.texgen = texgen, gMatState.mtlReady = 0;
 	//if (gMatState.texgen) fprintf(stderr, "texgen = %d\n", gMatState.texgen);
 	
 	/* backface/frontface culling */
-	glEnable(GL_CULL_FACE);
 	switch (gMatState.geometrymode & (G_CULL_FRONT | G_CULL_BACK)) {
 		case G_CULL_FRONT | G_CULL_BACK:
-			glCullFace(GL_FRONT_AND_BACK);
+			state_cull(N64_CULL_FRONT_AND_BACK);
 			break;
 		case G_CULL_FRONT:
-			glCullFace(GL_FRONT);
+			state_cull(N64_CULL_FRONT);
 			break;
 		case G_CULL_BACK:
-			glCullFace(GL_BACK);
+			state_cull(N64_CULL_BACK);
 			break;
 		default:
-			glDisable(GL_CULL_FACE);
+			state_cull(N64_CULL_NONE);
 			break;
 	}
 	
 	return false;
 }
 
-static bool gbiFunc_mtx(void* cmd) {
-	uint8_t* b = cmd;
-	uint8_t params = b[3] ^ G_MTX_PUSH;
-	uint32_t mtxaddr = u32r(b + 4);
+static bool gbiFunc_mtx(const GbiCmd* cmd) {
+	uint8_t params = (cmd->w0 & 0xff) ^ G_MTX_PUSH;
+	uint32_t mtxaddr = cmd->w1;
 	GbiMtx* mtx;
 	Mtx mtxF;
 	
@@ -1914,11 +2595,12 @@ static bool gbiFunc_mtx(void* cmd) {
 		memcpy(&mtxF, &sClearMtx, sizeof(sClearMtx));
 	else {
 		//bool wasDirectAddress = gPtrHiSet;
-		mtx = n64_segment_get(mtxaddr);
+		mtx = cmd_segment(cmd);
 		
 		if (!mtx)
 			return false;
 		
+		trace_touch(mtx, sizeof(*mtx));
 		GbiMtx swap = *mtx;
 		
 		// XXX assuming all matrices are in N64 format and in need of byteswap
@@ -1941,6 +2623,9 @@ static bool gbiFunc_mtx(void* cmd) {
 		assert(gMatrix.modelNow - gMatrix.modelStack < N64_MTX_STACK_SIZE && "matrix stack overflow");
 		
 		*gMatrix.modelNow = *(gMatrix.modelNow - 1);
+		
+		if (sStatsEnabled && (uint32_t)(gMatrix.modelNow - gMatrix.modelStack) > sStats.maxMtxDepth)
+			sStats.maxMtxDepth = gMatrix.modelNow - gMatrix.modelStack;
 	}
 	
 	if (params & G_MTX_LOAD) {
@@ -1953,9 +2638,8 @@ static bool gbiFunc_mtx(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_popmtx(void* cmd) {
-	uint8_t* b = cmd;
-	int num = u32r(b + 4) / 0x40;
+static bool gbiFunc_popmtx(const GbiCmd* cmd) {
+	int num = cmd->w1 / 0x40;
 	
 	gMatrix.modelNow -= num;
 	
@@ -1968,20 +2652,17 @@ static bool gbiFunc_popmtx(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_dl(void* cmd) {
-	uint8_t* b = cmd;
-	// uint32_t hi = u32r(b);
-	uint32_t lo = u32r(b + 4);
+static bool gbiFunc_dl(const GbiCmd* cmd) {
+	sDlJump.dlist = cmd_segment(cmd);
+	sDlJump.push = ((cmd->w0 >> 16) & 0xff) == 0;
+	sDlJump.set = true;
 	
-	n64_drawImpl(n64_segment_get(lo));
-	
-	return b[1] != 0;
+	return false;
 }
 
-static bool gbiFunc_setptrhi(void* cmd) {
+static bool gbiFunc_setptrhi(const GbiCmd* cmd) {
 #if __SIZEOF_POINTER__ == 8
-		uint8_t* b = cmd;
-		gPtrHi = u32r(b + 4);
+		gPtrHi = cmd->w1;
 		gPtrHi <<= 32;
 #else
 		gPtrHi = 0;
@@ -1991,20 +2672,19 @@ static bool gbiFunc_setptrhi(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_moveword(void* cmd) {
-	uint8_t* b = cmd;
-	uint32_t hi = u32r(b);
-	uint32_t lo = u32r(b + 4);
-	uint8_t index = b[1];
+static bool gbiFunc_moveword(const GbiCmd* cmd) {
+	uint32_t hi = cmd->w0;
+	uint32_t lo = cmd->w1;
+	uint8_t index = (hi >> 16) & 0xff;
 	uint16_t offset = hi & 0xffff;
-	void* data = n64_segment_get(lo);
+	void* data = segment_resolve(lo);
 	
 	switch (index) {
 		case G_MW_MATRIX: break; // TODO
 		case G_MW_NUMLIGHT: break; // TODO
 		case G_MW_CLIP: break; // TODO
 		case G_MW_SEGMENT:
-			n64_segment[offset / 4] = data;
+			sSegment[offset / 4] = data;
 			break;
 		case G_MW_FOG: break; // TODO
 		case G_MW_LIGHTCOL: break; // TODO
@@ -2016,10 +2696,9 @@ static bool gbiFunc_moveword(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_branch_z(void* cmd) {
-	uint8_t* b = cmd;
-	uint32_t hi = u32r(b);
-	uint32_t lo = u32r(b + 4);
+static bool gbiFunc_branch_z(const GbiCmd* cmd) {
+	uint32_t hi = cmd->w0;
+	uint32_t lo = cmd->w1;
 	int vbidx0 = ((hi >> 12) & 0xfff) / 5;
 	int vbidx1 = (hi & 0xfff) / 2;
 	
@@ -2039,34 +2718,29 @@ static bool gbiFunc_branch_z(void* cmd) {
 	// simulate branching
 	if (z <= lo)
 	{
-		n64_drawImpl(n64_segment_get(gRdpHalf1));
-		return true;
+		sDlJump.dlist = n64_segment_get(gRdpHalf1);
+		sDlJump.push = false;
+		sDlJump.set = true;
 	}
 	
 	return false;
 }
 
-static bool gbiFunc_rdphalf_1(void* cmd) {
-	uint8_t* b = cmd;
-	
-	gRdpHalf1 = u32r(b + 4);
+static bool gbiFunc_rdphalf_1(const GbiCmd* cmd) {
+	gRdpHalf1 = cmd->w1;
 	
 	return false;
 }
 
-static bool gbiFunc_rdphalf_2(void* cmd) {
-	uint8_t* b = cmd;
-	
-	gRdpHalf2 = u32r(b + 4);
+static bool gbiFunc_rdphalf_2(const GbiCmd* cmd) {
+	gRdpHalf2 = cmd->w1;
 	
 	return false;
 }
 
-static bool gbiFunc_xmode(void* cmd) {
-	uint8_t* b = cmd;
-	
-	uint32_t clear = u32r(b);
-	uint32_t set = u32r(b + 4);
+static bool gbiFunc_xmode(const GbiCmd* cmd) {
+	uint32_t clear = cmd->w0;
+	uint32_t set = cmd->w1;
 	
 	if (clear & GX_MODE_OUTLINE)
 		gGxOutline = false;
@@ -2075,50 +2749,41 @@ static bool gbiFunc_xmode(void* cmd) {
 		gGxOutline = true;
 	
 	if (clear & GX_MODE_POLYGONOFFSET) {
-		glDisable(GL_POLYGON_OFFSET_FILL);
-		glDisable(GL_POLYGON_OFFSET_LINE);
-		glPolygonOffset(0, 0);
+		state_bool(STATE_OFFSET_FILL, false);
+		state_bool(STATE_OFFSET_LINE, false);
+		state_polygon_offset(0, 0);
 	}
 	
 	if (clear & GX_MODE_WIREFRAME) {
-		glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+		state_bool(STATE_WIREFRAME, false);
 	}
 	
 	if (set & GX_MODE_POLYGONOFFSET) {
-		glEnable(GL_POLYGON_OFFSET_FILL);
-		glEnable(GL_POLYGON_OFFSET_LINE);
-		glPolygonOffset(-2, -2);
+		state_bool(STATE_OFFSET_FILL, true);
+		state_bool(STATE_OFFSET_LINE, true);
+		state_polygon_offset(-2, -2);
 	}
 	
 	if (set & GX_MODE_WIREFRAME) {
-		glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+		state_bool(STATE_WIREFRAME, true);
 	}
 	
 	return false;
 }
 
-static bool gbiFunc_xhlight(void* cmd) {
+static bool gbiFunc_xhlight(const GbiCmd* cmd) {
 	struct {
-		union {
-			struct {
-				uint8_t cmd;
-				uint8_t r;
-				uint8_t g;
-				uint8_t b;
-			};
-			uint32_t upper;
-		};
-		union {
-			struct {
-				uint8_t reserved[2];
-				uint8_t factor;
-				uint8_t mode;
-			};
-			uint32_t lower;
-		};
+		uint8_t r;
+		uint8_t g;
+		uint8_t b;
+		uint8_t factor;
+		uint8_t mode;
 	} c = {
-		.upper = *((uint32_t*)cmd),
-		.lower = *((uint32_t*)cmd + 1)
+		.r = (cmd->w0 >> 16) & 0xff,
+		.g = (cmd->w0 >> 8) & 0xff,
+		.b = cmd->w0 & 0xff,
+		.factor = (cmd->w1 >> 8) & 0xff,
+		.mode = cmd->w1 & 0xff
 		,
 	};
 	
@@ -2134,9 +2799,8 @@ static bool gbiFunc_xhlight(void* cmd) {
 	return false;
 }
 
-static bool gbiFunc_setid(void* cmd) {
-	const uint8_t* b = cmd;
-	gSetId = u32r(b + 4);
+static bool gbiFunc_setid(const GbiCmd* cmd) {
+	gSetId = cmd->w1;
 
 	return false;
 }
@@ -2207,7 +2871,7 @@ static void recompute_normal_matrix(void)
 	}
 }
 
-static GbiFunc gGbi[0xFF] = {
+static GbiFunc gGbi[0x100] = {
 	[G_VTX] =             gbiFunc_vtx,
 	[G_CULLDL] =          gbiFunc_culldl,
 	[G_TRI1] =            gbiFunc_tri1,
@@ -2254,13 +2918,69 @@ static GbiFunc gGbi[0xFF] = {
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+/* a segment address has 24 bits of offset, so this is as far as any can reach */
+#define SEGMENT_SIZE_MAX 0x1000000
+
+/* sizes given to n64_segment_set_sized(), which only hold while the
+ * segment still points where it did; n64_segment is also written directly */
+static struct {
+	void*    base;
+	uint32_t size;
+} sSegmentSize[N64_SEGMENT_MAX];
+
+/* segments sorted by base address, for n64_segment_ptr_offset() */
+static struct {
+	void*   seen[N64_SEGMENT_MAX]; /* n64_segment when it was sorted */
+	uint8_t order[N64_SEGMENT_MAX];
+	int     num;
+	bool    valid;
+} sSegmentIndex;
+
+static uint32_t segment_size(int seg, const void* base) {
+	if (base && sSegmentSize[seg].base == base)
+		return sSegmentSize[seg].size;
+	
+	return SEGMENT_SIZE_MAX;
+}
+
+static void segment_index(void) {
+	if (sSegmentIndex.valid && !memcmp(sSegmentIndex.seen, n64_segment, sizeof(n64_segment)))
+		return;
+	
+	memcpy(sSegmentIndex.seen, n64_segment, sizeof(n64_segment));
+	sSegmentIndex.num = 0;
+	sSegmentIndex.valid = true;
+	
+	/* descending, so of segments sharing a base the lowest sorts last */
+	for (int seg = N64_SEGMENT_MAX - 1; seg >= 0; --seg) {
+		uint8_t* base = n64_segment[seg];
+		int i = sSegmentIndex.num++;
+		
+		if (!base) {
+			--sSegmentIndex.num;
+			continue;
+		}
+		
+		for (; i > 0 && (uint8_t*)n64_segment[sSegmentIndex.order[i - 1]] > base; --i)
+			sSegmentIndex.order[i] = sSegmentIndex.order[i - 1];
+		sSegmentIndex.order[i] = seg;
+	}
+}
+
 void n64_segment_set(int seg, void* data) {
+	n64_segment_set_sized(seg, data, SEGMENT_SIZE_MAX);
+}
+
+void n64_segment_set_sized(int seg, void* data, uint32_t size) {
 	assert(seg < N64_SEGMENT_MAX);
 	
 	n64_segment[seg] = data;
+	sSegmentSize[seg].base = data;
+	sSegmentSize[seg].size = size < SEGMENT_SIZE_MAX ? size : SEGMENT_SIZE_MAX;
 }
 
-void* n64_segment_get(unsigned int segaddr) {
+/* not translated for trace replay, so it can be stored in the segment table */
+static void* segment_resolve(unsigned int segaddr) {
 	uint8_t* b;
 	
 	if (gPtrHiSet) {
@@ -2275,40 +2995,55 @@ void* n64_segment_get(unsigned int segaddr) {
 	
 	assert((segaddr >> 24) < N64_SEGMENT_MAX);
 	
-	b = n64_segment[segaddr >> 24];
+	b = sSegment[segaddr >> 24];
 	
 	if (!b)
 		return 0;
 	
+	if ((segaddr & 0xffffff) >= segment_size(segaddr >> 24, b))
+		return 0;
+	
 	return b + (segaddr & 0xffffff);
 }
 
+void* n64_segment_get(unsigned int segaddr) {
+	void* ptr = segment_resolve(segaddr);
+	
+	if (sTraceReplay)
+		return trace_translate(sTraceReplay, ptr);
+	
+	return ptr;
+}
+
 unsigned int n64_segment_ptr_offset(void* cmd) {
 	uint8_t* b = cmd;
-	ptrdiff_t dist = -1;
-	int smallest = -1;
-	int i;
+	int lo = 0;
+	int hi;
 	
 	if (!b)
 		return 0;
 	
-	for (i = 0; i < N64_SEGMENT_MAX; ++i) {
-		uint8_t* this = n64_segment[i];
-		
-		if (!this)
-			continue;
-		
-		if (b < this)
-			continue;
+	segment_index();
+	hi = sSegmentIndex.num;
+	
+	/* first segment starting past the pointer */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
 		
-		if (b - this < dist) {
-			smallest = i;
-			dist = b - this;
-		}
+		if ((uint8_t*)n64_segment[sSegmentIndex.order[mid]] <= b)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 	
-	if (smallest >= 0)
-		return (smallest << 24) | dist;
+	/* nearest base first, falling back to a larger segment it may be nested in */
+	while (lo--) {
+		int seg = sSegmentIndex.order[lo];
+		uint8_t* base = n64_segment[seg];
+		
+		if ((size_t)(b - base) < segment_size(seg, base))
+			return (seg << 24) | (b - base);
+	}
 	
 	return 0;
 }
@@ -2364,75 +3099,604 @@ void* n64_graph_alloc(uint32_t sz) {
 	return (n64_graph_ptr += sz) - sz;
 }
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* display lists are decoded once into native-endian GbiCmd arrays with
+ * their segment addresses already resolved (up to the first G_DL,
+ * which could change a segment), then replayed from here on
+ * subsequent frames; entries are keyed by the list's address and by the
+ * contents of the segment table at the time it is called, so the cache
+ * is only valid for display lists whose bytes don't change (use
+ * n64_clear_cache() after editing one in place)
+ */
+static bool sDlCacheEnabled = false;
+static DlCache* sDlCache[N64_DLCACHE_BUCKETS];
+static uint32_t sDlCacheCount = 0;
+
+static void dlcache_cleanup(void) {
+	for (int i = 0; i < N64_DLCACHE_BUCKETS; ++i) {
+		DlCache* next;
+		
+		for (DlCache* dl = sDlCache[i]; dl; dl = next) {
+			next = dl->next;
+			free(dl);
+		}
+		
+		sDlCache[i] = 0;
+	}
+	
+	sDlCacheCount = 0;
+}
+
+static uint32_t dlcache_seghash(void) {
+	uint32_t hash = 2166136261u; // fnv-1a
+	
+	for (int i = 0; i < N64_SEGMENT_MAX; ++i) {
+		uint64_t v = (uintptr_t)sSegment[i];
+		
+		hash = (hash ^ (uint32_t)v) * 16777619u;
+		hash = (hash ^ (uint32_t)(v >> 32)) * 16777619u;
+	}
+	
+	return hash;
+}
+
+static bool cache_is_volatile(const void* data) {
+	const uint8_t* b = data;
+	
+	/* these are rebuilt every frame, so the same address holds new commands */
+	if (b >= (uint8_t*)n64_poly_opa_head && b < (uint8_t*)(n64_poly_opa_head + N64_OPA_STACK_SIZE))
+		return true;
+	if (b >= (uint8_t*)n64_poly_xlu_head && b < (uint8_t*)(n64_poly_xlu_head + N64_XLU_STACK_SIZE))
+		return true;
+	if (b >= n64_graph_buffer && b < n64_graph_buffer + sizeof(n64_graph_buffer))
+		return true;
+	
+	return false;
+}
+
+static DlCache* dlcache_decode(const void* dlist, uint32_t segHash) {
+	const uint8_t* b = dlist;
+	bool cacheable = true;
+	bool afterCall = false;
+	uint32_t num;
+	DlCache* dl;
+	
+	/* find the end of the list, and whether it can be resolved ahead of time */
+	for (num = 1; ; ++num, b += 8) {
+		if (b[0] == G_SETPTRHI || (b[0] == G_MOVEWORD && b[1] == G_MW_SEGMENT))
+			cacheable = false;
+		
+		if (b[0] == G_ENDDL || (b[0] == G_DL && b[1] != 0))
+			break;
+	}
+	
+	if (!cacheable)
+		num = 0;
+	
+	/* one extra command so the last one can always peek at the next */
+	dl = malloc(sizeof(*dl) + sizeof(*dl->cmd) * (num + 1));
+	assert(dl);
+	dl->next = 0;
+	dl->dlist = dlist;
+	dl->segHash = segHash;
+	dl->num = num;
+	
+	b = dlist;
+	for (uint32_t i = 0; i < num; ++i, b += 8) {
+		GbiCmd* cmd = &dl->cmd[i];
+		
+		cmd->w0 = u32r(b);
+		cmd->w1 = u32r(b + 4);
+		cmd->func = gGbi[b[0]];
+		cmd->ptr = 0;
+		
+		/* a callee can change segments, so the rest resolve as they run */
+		if (afterCall)
+			continue;
+		
+		switch (b[0]) {
+			case G_MTX:
+				if (cmd->w1 == 0x8012DB20) /* XXX hard-coded gMtxClear */
+					break;
+				// fallthrough
+			case G_VTX:
+			case G_SETTIMG:
+			case G_DL:
+				cmd->ptr = n64_segment_get(cmd->w1);
+				break;
+		}
+		
+		if (b[0] == G_DL)
+			afterCall = true;
+	}
+	
+	dl->cmd[num] = (GbiCmd) { gGbi[G_ENDDL], (uint32_t)G_ENDDL << 24, 0, 0 };
+	
+	return dl;
+}
+
+static DlCache* dlcache_get(const void* dlist) {
+	uint32_t segHash;
+	DlCache** bucket;
+	DlCache* dl;
+	
+	if (!sDlCacheEnabled || sTraceCapture || cache_is_volatile(dlist))
+		return 0;
+	
+	segHash = dlcache_seghash();
+	bucket = &sDlCache[(((uintptr_t)dlist >> 3) ^ segHash) % N64_DLCACHE_BUCKETS];
+	
+	pthread_mutex_lock(&sCacheLock);
+	for (dl = *bucket; dl; dl = dl->next) {
+		if (dl->dlist == dlist && dl->segHash == segHash)
+			goto L_done;
+	}
+	
+	/* segment tables that change every frame would grow this forever;
+	 * other decode threads may still be walking the old entries */
+	if (sDlCacheCount >= N64_DLCACHE_MAX) {
+		if (sParallel)
+			goto L_done;
+		dlcache_cleanup();
+		bucket = &sDlCache[(((uintptr_t)dlist >> 3) ^ segHash) % N64_DLCACHE_BUCKETS];
+	}
+	
+	dl = dlcache_decode(dlist, segHash);
+	dl->next = *bucket;
+	*bucket = dl;
+	sDlCacheCount += 1;
+	
+L_done:
+	pthread_mutex_unlock(&sCacheLock);
+	
+	return dl;
+}
+
+bool n64_dlist_cache(bool state) {
+	if (!state)
+		dlcache_cleanup();
+	
+	return sDlCacheEnabled = state;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* converted G_VTX loads, keyed by the source address and count and by the
+ * state the conversion depends on (VtxKey); like the display list cache,
+ * it assumes the source bytes don't change (use n64_clear_cache()) */
+static bool sVtxCacheEnabled = false;
+static VtxCache* sVtxCache[N64_VTXCACHE_BUCKETS];
+static uint32_t sVtxCacheCount = 0;
+
+static void vtxcache_cleanup(void) {
+	for (int i = 0; i < N64_VTXCACHE_BUCKETS; ++i) {
+		VtxCache* next;
+		
+		for (VtxCache* v = sVtxCache[i]; v; v = next) {
+			next = v->next;
+			free(v);
+		}
+		
+		sVtxCache[i] = 0;
+	}
+	
+	sVtxCacheCount = 0;
+}
+
+static bool vtxcache_key(const void* src, VtxKey* key, uint32_t* hash) {
+	const uint32_t* w = (const void*)key;
+	uint32_t h = 2166136261u; // fnv-1a
+	
+	if (!sVtxCacheEnabled || sTraceCapture || cache_is_volatile(src))
+		return false;
+	
+#ifndef RENDERHOOK_UOT
+	/* texture coordinates would depend on the tile state too */
+	return false;
+#endif
+	
+	memset(key, 0, sizeof(*key));
+	key->model = *gMatrix.modelNow;
+	key->flags = gVertexColors | gGxOutline << 1 | (gMatState.texgen != 0) << 2;
+	
+	for (uint32_t i = 0; i < sizeof(*key) / sizeof(*w); ++i)
+		h = (h ^ w[i]) * 16777619u;
+	*hash = h ^ (uint32_t)((uintptr_t)src >> 3);
+	
+	return true;
+}
+
+static const VtxCache* vtxcache_get(const void* src, uint32_t num, const VtxKey* key, uint32_t hash) {
+	VtxCache* v;
+	
+	pthread_mutex_lock(&sCacheLock);
+	for (v = sVtxCache[hash % N64_VTXCACHE_BUCKETS]; v; v = v->next) {
+		if (v->hash == hash && v->src == src && v->num == num && !memcmp(&v->key, key, sizeof(*key)))
+			break;
+	}
+	pthread_mutex_unlock(&sCacheLock);
+	
+	if (sStatsEnabled) {
+		if (v)
+			sStats.vtxHits += 1;
+		else
+			sStats.vtxMisses += 1;
+	}
+	
+	return v;
+}
+
+static void vtxcache_put(const void* src, uint32_t num, const VtxKey* key, uint32_t hash, const N64Vtx* vtx) {
+	VtxCache** bucket = &sVtxCache[hash % N64_VTXCACHE_BUCKETS];
+	VtxCache* v;
+	
+	pthread_mutex_lock(&sCacheLock);
+	
+	/* matrices that change every frame would grow this forever;
+	 * other decode threads may still be reading the old entries */
+	if (sVtxCacheCount >= N64_VTXCACHE_MAX) {
+		if (sParallel)
+			goto L_done;
+		vtxcache_cleanup();
+	}
+	
+	v = malloc(sizeof(*v) + sizeof(*v->vtx) * num);
+	assert(v);
+	v->src = src;
+	v->num = num;
+	v->hash = hash;
+	v->key = *key;
+	memcpy(v->vtx, vtx, sizeof(*vtx) * num);
+	v->next = *bucket;
+	*bucket = v;
+	sVtxCacheCount += 1;
+	
+L_done:
+	pthread_mutex_unlock(&sCacheLock);
+}
+
+bool n64_vertex_cache(bool state) {
+	if (!state)
+		vtxcache_cleanup();
+	
+	return sVtxCacheEnabled = state;
+}
+
 void n64_clear_cache(void) {
 	ShaderList_cleanup();
-	for (int32_t i = 0; i < gTexelCacheCount; i++) {
-		gTexelDict[i] = 0;
-		gTexel[i] = 0;
-	}
+	gShader = 0;
+	
+	/* the next material is built from scratch */
+	gMatState.mtlReady = 0;
+	gMatState.tile[0].doUpdate = true;
+	gMatState.tile[1].doUpdate = true;
+	
+	dlcache_cleanup();
+	vtxcache_cleanup();
+	for (uint32_t i = 0; i < gTexelNum; i++)
+		gBackend->texture_delete(gTexel[i]);
+	free(gTexel);
+	free(gTexelDict);
+	free(gTexelShare);
+	gTexel = 0;
+	gTexelNum = 0;
+	gTexelMissed = 0;
+	gTexelDict = 0;
+	gTexelDictSize = 0;
+	gTexelDictCount = 0;
+	gTexelShare = 0;
+	gTexelShareSize = 0;
 	gTexelCacheCount = 0;
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-static void n64_drawImpl(void* dlist) {
-	uint8_t* cmd;
-	
-	if (!dlist)
+void n64_set_backend(const N64Backend* backend) {
+	if (backend == gBackend)
 		return;
 	
-	glDepthFunc(GL_LESS);
+	/* shaders and textures belong to the previous backend */
+	n64_clear_cache();
+	if (sOutlineShader) {
+		gBackend->shader_delete(sOutlineShader);
+		sOutlineShader = 0;
+	}
+	
+	gBackend = backend;
+	sLightsDirty = true;
+}
+
+const N64Backend* n64_get_backend(void) {
+	return gBackend;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define GBI_NAME(OP) [OP] = #OP
+
+static const char* sGbiName[0x100] = {
+	GBI_NAME(G_NOOP),
+	GBI_NAME(G_VTX),
+	GBI_NAME(G_MODIFYVTX),
+	GBI_NAME(G_CULLDL),
+	GBI_NAME(G_BRANCH_Z),
+	GBI_NAME(G_TRI1),
+	GBI_NAME(G_TRI2),
+	GBI_NAME(G_QUAD),
+	GBI_NAME(G_LINE3D),
+	GBI_NAME(G_SETPTRHI),
+	GBI_NAME(G_DMA_IO),
+	GBI_NAME(G_TEXTURE),
+	GBI_NAME(G_POPMTX),
+	GBI_NAME(G_GEOMETRYMODE),
+	GBI_NAME(G_MTX),
+	GBI_NAME(G_MOVEWORD),
+	GBI_NAME(G_MOVEMEM),
+	GBI_NAME(G_LOAD_UCODE),
+	GBI_NAME(G_DL),
+	GBI_NAME(G_ENDDL),
+	GBI_NAME(G_SPNOOP),
+	GBI_NAME(G_RDPHALF_1),
+	GBI_NAME(G_SETOTHERMODE_L),
+	GBI_NAME(G_SETOTHERMODE_H),
+	GBI_NAME(G_TEXRECT),
+	GBI_NAME(G_TEXRECTFLIP),
+	GBI_NAME(G_RDPLOADSYNC),
+	GBI_NAME(G_RDPPIPESYNC),
+	GBI_NAME(G_RDPTILESYNC),
+	GBI_NAME(G_RDPFULLSYNC),
+	GBI_NAME(G_SETKEYGB),
+	GBI_NAME(G_SETKEYR),
+	GBI_NAME(G_SETCONVERT),
+	GBI_NAME(G_SETSCISSOR),
+	GBI_NAME(G_SETPRIMDEPTH),
+	GBI_NAME(G_RDPSETOTHERMODE),
+	GBI_NAME(G_LOADTLUT),
+	GBI_NAME(G_RDPHALF_2),
+	GBI_NAME(G_SETTILESIZE),
+	GBI_NAME(G_LOADBLOCK),
+	GBI_NAME(G_LOADTILE),
+	GBI_NAME(G_SETTILE),
+	GBI_NAME(G_FILLRECT),
+	GBI_NAME(G_SETFILLCOLOR),
+	GBI_NAME(G_SETFOGCOLOR),
+	GBI_NAME(G_SETBLENDCOLOR),
+	GBI_NAME(G_SETPRIMCOLOR),
+	GBI_NAME(G_SETENVCOLOR),
+	GBI_NAME(G_SETCOMBINE),
+	GBI_NAME(G_SETTIMG),
+	GBI_NAME(G_SETZIMG),
+	GBI_NAME(G_SETCIMG),
+	
+	GBI_NAME(GX_MODE),
+	GBI_NAME(GX_HILIGHT),
+	GBI_NAME(GX_SETID),
+};
+
+bool n64_stats(bool state) {
+	return sStatsEnabled = state;
+}
+
+void n64_stats_get(N64Stats* dst) {
+	*dst = sStats;
+}
+
+void n64_stats_reset(void) {
+	memset(&sStats, 0, sizeof(sStats));
+}
+
+const char* n64_stats_opname(uint8_t op) {
+	return sGbiName[op] ? sGbiName[op] : "unknown";
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static inline bool gbi_dispatch(const GbiCmd* cmd) {
+	bool shouldExit;
+	
+	if (sStatsEnabled) {
+		uint64_t start = stats_clock();
+		
+		shouldExit = (cmd->func && cmd->func(cmd));
+		sStats.op[GBICMD_OP(cmd)].cycles += stats_clock() - start;
+		sStats.op[GBICMD_OP(cmd)].count += 1;
+	} else
+		shouldExit = (cmd->func && cmd->func(cmd));
 	
-	if (!gVAO)
-		glGenVertexArrays(1, &gVAO);
-	if (!gVBO)
-		glGenBuffers(1, &gVBO);
-	if (!gEBO)
-		glGenBuffers(1, &gEBO);
+#ifdef RENDERHOOK_UOT
+	// Update history ringbuffer
+	gMatState.history[gMatState.historyI] = GBICMD_OP(cmd);
+	gMatState.historyI = (gMatState.historyI + 1) % ARRLEN(gMatState.history);
+#endif
 	
-	/* set up texture stuff */
-	if (!gTexel[0])
-		glGenTextures(N64_TEXTURE_CACHE_SIZE, gTexel);
+	return shouldExit;
+}
+
+typedef struct {
+	const GbiCmd*  cmd; /* pre-decoded, or */
+	const uint8_t* b;   /* decode as we go */
+} DlFrame;
+
+static void dl_enter(DlFrame* frame, const void* dlist) {
+	DlCache* dl;
 	
-	/* set up geometry stuff */
-	glBindVertexArray(gVAO);
+	if ((dl = dlcache_get(dlist)) && dl->num)
+		*frame = (DlFrame) { dl->cmd, 0 };
+	else
+		*frame = (DlFrame) { 0, dlist };
 	
-	glBindBuffer(GL_ARRAY_BUFFER, gVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(sVbuf), sVbuf, GL_DYNAMIC_DRAW);
+	if (sStatsEnabled)
+		sStats.dlists += 1;
+}
+
+/* walks G_DL and G_BRANCH_Z with an explicit return stack instead of
+ * recursing, so nested display lists cost no more than a branch */
+static void n64_drawImpl(void* dlist) {
+	DlFrame stack[N64_DL_STACK_SIZE];
+	DlFrame* sp = stack;
+	DlFrame now;
 	
-	/* pos */
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, pos));
-	glEnableVertexAttribArray(0);
+	if (!dlist)
+		return;
+	
+	sDlJump.set = false;
+	dl_enter(&now, dlist);
+	
+	for (;;) {
+		const GbiCmd* cmd;
+		GbiCmd raw[2];
+		bool shouldExit;
+		
+		if (now.cmd)
+			cmd = now.cmd++;
+		else {
+			const uint8_t* b = now.b;
+			
+			//fprintf(stderr, "%08x %08x\n", u32r(b), u32r(b + 4));
+			trace_touch(b, (b[0] == G_ENDDL) ? 8 : 9);
+			raw[0] = (GbiCmd) { gGbi[b[0]], u32r(b), u32r(b + 4), 0 };
+			raw[1].w0 = (b[0] == G_ENDDL) ? 0 : (uint32_t)b[8] << 24;
+			now.b += 8;
+			cmd = raw;
+		}
+		
+		shouldExit = gbi_dispatch(cmd);
+		
+		if (sDlJump.set) {
+			sDlJump.set = false;
+			
+			if (sDlJump.push) {
+				if (!sDlJump.dlist)
+					continue;
+				
+				assert(sp - stack < N64_DL_STACK_SIZE && "display list stack overflow");
+				if (sp - stack >= N64_DL_STACK_SIZE)
+					continue;
+				
+				*sp++ = now;
+				
+				if (sStatsEnabled && (uint32_t)(sp - stack) > sStats.maxDepth)
+					sStats.maxDepth = sp - stack;
+			}
+			
+			/* branching to nothing ends the current list */
+			if (sDlJump.dlist) {
+				dl_enter(&now, sDlJump.dlist);
+				continue;
+			}
+			shouldExit = true;
+		}
+		
+		if (shouldExit) {
+			if (sp == stack)
+				break;
+			now = *--sp;
+		}
+	}
+}
+
+/* decode threads can't create textures, so each flush starts with names
+ * for N64_TEXTURE_CACHE_SIZE new ones, plus those the last one ran out of */
+static void texel_init(void) {
+	if (sParallel)
+		return;
 	
-	/* color */
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, color));
-	glEnableVertexAttribArray(1);
+	texel_reserve(gTexelCacheCount + gTexelMissed + N64_TEXTURE_CACHE_SIZE);
+	gTexelMissed = 0;
+}
+
+/* draws every outline since the last pass over everything else (x-ray),
+ * setting up the state it needs instead of saving and restoring it */
+static void outline_draw(void) {
+	uint32_t num = 0;
+	
+	for (uint32_t i = 0; i < N64_ARRAY_COUNT(sOutlineBuf); ++i)
+		num += sOutlineBuf[i][0].num + sOutlineBuf[i][1].num;
+	if (!num)
+		return;
 	
-	/* texcoord0 */
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, texcoord0));
-	glEnableVertexAttribArray(2);
+	gBackend->begin();
+	state_forget();
+	state_bool(STATE_BLEND, true);
+	state_bool(STATE_DEPTH_TEST, false);
+	state_bool(STATE_WIREFRAME, false);
 	
-	/* texcoord1 */
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, texcoord1));
-	glEnableVertexAttribArray(3);
+	gBackend->shader_use(sOutlineShader);
+	gBackend->shader_mat4(sOutlineShader, "view", &gMatrix.view);
+	gBackend->shader_mat4(sOutlineShader, "projection", &gMatrix.projection);
+	//gBackend->shader_vec4(sOutlineShader, "color", 1, 0.5, 0, 1); // opaque orange
+	gBackend->shader_vec4(sOutlineShader, "color", 1, 0.5, 0, 0.5); // translucent orange
 	
-	for (cmd = dlist; ; cmd += 8) {
-		//fprintf(stderr, "%08x %08x\n", u32r(cmd), u32r(cmd + 4));
-		bool shouldExit = (gGbi[*cmd] && gGbi[*cmd](cmd));
-	#ifdef RENDERHOOK_UOT
-		// Update history ringbuffer
-		gMatState.history[gMatState.historyI] = *cmd;
-		gMatState.historyI = (gMatState.historyI + 1) % ARRLEN(gMatState.history);
-	#endif
-		if (shouldExit)
-			break;
+	for (int k = 0; k < 2; ++k) {
+		state_cull(k ? N64_CULL_NONE : N64_CULL_FRONT);
+		
+		for (uint32_t i = 0; i < N64_ARRAY_COUNT(sOutlineBuf); ++i) {
+			OutlineList* list = &sOutlineBuf[i][k];
+			
+			if (list->num)
+				gBackend->draw_outline(list->vtx, list->num);
+			list->num = 0;
+		}
 	}
+	
+	gBackend->end();
+	state_forget();
+	
+	/* the material's shader has to be bound again */
+	gMatState.mtlReady = 0;
 }
 
 void n64_draw_dlist(void* dlist) {
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	if (sTraceCapture)
+		trace_draw(dlist);
+	
+	/* set up texture stuff */
+	texel_init();
+	
+	/* set up geometry stuff */
+	mtx_mtx_mul(&gMatrix.projection, &gMatrix.view, &sCullMtx);
+	gBackend->begin();
+	gBackend->vertices(sVbuf, N64_VBUF_MAX);
+	if (!sParallel)
+		lights_upload();
+	memset(sVbufCull, 0, sizeof(sVbufCull));
+	memset(sVbufLoaded, 0, sizeof(sVbufLoaded));
+	
+	state_forget();
+	state_bool(STATE_STENCIL, true);
 	n64_drawImpl(dlist);
+	gBackend->end();
+	
+	if (!sOutlineDeferred)
+		outline_draw();
+}
+
+/* the bake keeps using the textures and shaders it was recorded with,
+ * so it has to be rebaked after n64_clear_cache() or n64_set_backend() */
+N64Bake* n64_bake_dlist(void* dlist) {
+	const N64Backend* backend = gBackend;
+	
+	/* a bake is drawn from any camera, so nothing can be culled */
+	gBackend = bake_record(backend);
+	sCullFrustum = false;
+	n64_draw_dlist(dlist);
+	sCullFrustum = true;
+	gBackend = backend;
+	
+	return bake_finish();
+}
+
+/* lights aren't part of the bake: lit geometry is shaded with the lights
+ * bound when it is drawn, not the ones it was baked with */
+void n64_bake_draw(const N64Bake* bake) {
+	lights_upload();
+	bake_draw(bake, gBackend, &gMatrix.view, &gMatrix.projection);
+	
+	/* textures and shader were changed behind the material state's back */
+	gMatState.mtlReady = 0;
+	gMatState.tile[0].doUpdate = true;
+	gMatState.tile[1].doUpdate = true;
 }
 
 #include <sys/time.h>
@@ -2452,13 +3716,14 @@ void n64_update_tick(void) {
 void n64_buffer_init(void) {
 	
 	sLightNum = 0;
+	sLightsDirty = true;
 	n64_buffer_clear();
-	Shader_use(0);
+	gBackend->shader_use(0);
 	n64_set_onlyZmode(N64_ZMODE_ALL);
 	n64_set_onlyGeoLayer(N64_GEOLAYER_ALL);
 	
 	if (!sOutlineShader) {
-		sOutlineShader = Shader_new();
+		sOutlineShader = gBackend->shader_new();
 		
 		const char* vtx = SHADER_SOURCE(
 			layout (location = 0) in vec4 aPos;
@@ -2484,23 +3749,297 @@ void n64_buffer_init(void) {
 				FragColor.rgba = color;
 			}
 		);
-		Shader_update(sOutlineShader, vtx, frag);
+		gBackend->shader_update(sOutlineShader, vtx, frag);
+	}
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* with n64_buffer_threads(true), n64_buffer_flush() decodes each of its
+ * display lists on its own thread into a command buffer (see n64cmd.c),
+ * then replays the buffers in order on the calling thread
+ *
+ * every list starts from the interpreter state at the time of the flush,
+ * rather than from what the list drawn before it left behind, and the
+ * tri and cull callbacks are called from the decode threads; tracing and
+ * n64_stats() fall back to decoding one list after another
+ */
+typedef struct {
+	Mtx      view;
+	Mtx      normal;
+	Mtx      projection;
+	Mtx      modelStack[N64_MTX_STACK_SIZE];
+	uint32_t modelNow;
+	typeof(gMatState) matState;
+	N64Vtx   vbuf[N64_VBUF_MAX];
+	void*    segment[N64_SEGMENT_MAX];
+	uint32_t setId;
+	uint32_t rdpHalf1;
+	uint32_t rdpHalf2;
+	uintptr_t ptrHi;
+	bool     ptrHiSet;
+	Shader*  shader;
+	enum N64Filter filterMode;
+	bool     hideGeometry;
+	bool     vertexColors;
+	bool     forceBl;
+	bool     cvgXalpha;
+	bool     gxOutline;
+	int      polygonOffset;
+	enum N64ZMode zmode;
+	enum N64ZMode currentZmode;
+} DecodeState;
+
+typedef struct {
+	void*       dlist;
+	DecodeState state;
+	CmdBuf*     buf;
+	OutlineList* outline;
+	const N64Backend* backend;
+	bool        sorted;
+} FlushJob;
+
+static CmdBuf sFlushBuf[N64_ARRAY_COUNT(sOutlineBuf)];
+
+/* decode threads are started by the first threaded flush and kept around */
+static struct {
+	pthread_t       thread[N64_ARRAY_COUNT(sFlushBuf) - 1];
+	bool            started[N64_ARRAY_COUNT(sFlushBuf) - 1];
+	FlushJob*       job[N64_ARRAY_COUNT(sFlushBuf) - 1];
+	uint32_t        pending;
+	pthread_mutex_t lock;
+	pthread_cond_t  wake;
+	pthread_cond_t  done;
+} sPool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+/* everything but the segment table, which the decode thread uses in place */
+static void decode_save(DecodeState* dst) {
+	dst->view = gMatrix.view;
+	dst->normal = gMatrix.normal;
+	dst->projection = gMatrix.projection;
+	memcpy(dst->modelStack, gMatrix.modelStack, sizeof(dst->modelStack));
+	dst->modelNow = gMatrix.modelNow - gMatrix.modelStack;
+	dst->matState = gMatState;
+	memcpy(dst->vbuf, sVbuf, sizeof(dst->vbuf));
+	dst->setId = gSetId;
+	dst->rdpHalf1 = gRdpHalf1;
+	dst->rdpHalf2 = gRdpHalf2;
+	dst->ptrHi = gPtrHi;
+	dst->ptrHiSet = gPtrHiSet;
+	dst->shader = gShader;
+	dst->filterMode = gFilterMode;
+	dst->hideGeometry = gHideGeometry;
+	dst->vertexColors = gVertexColors;
+	dst->forceBl = gForceBl;
+	dst->cvgXalpha = gCvgXalpha;
+	dst->gxOutline = gGxOutline;
+	dst->polygonOffset = gPolygonOffset;
+	dst->zmode = gOnlyThisZmode;
+	dst->currentZmode = gCurrentZmode;
+}
+
+static void decode_load(const DecodeState* src) {
+	gMatrix.view = src->view;
+	gMatrix.normal = src->normal;
+	gMatrix.projection = src->projection;
+	memcpy(gMatrix.modelStack, src->modelStack, sizeof(gMatrix.modelStack));
+	gMatrix.modelNow = gMatrix.modelStack + src->modelNow;
+	gMatState = src->matState;
+	memcpy(sVbuf, src->vbuf, sizeof(sVbuf));
+	gSetId = src->setId;
+	gRdpHalf1 = src->rdpHalf1;
+	gRdpHalf2 = src->rdpHalf2;
+	gPtrHi = src->ptrHi;
+	gPtrHiSet = src->ptrHiSet;
+	gShader = src->shader;
+	gFilterMode = src->filterMode;
+	gHideGeometry = src->hideGeometry;
+	gVertexColors = src->vertexColors;
+	gForceBl = src->forceBl;
+	gCvgXalpha = src->cvgXalpha;
+	gGxOutline = src->gxOutline;
+	gPolygonOffset = src->polygonOffset;
+	gOnlyThisZmode = src->zmode;
+	gCurrentZmode = src->currentZmode;
+}
+
+static void* flush_decode(void* arg) {
+	FlushJob* job = arg;
+	void** segment = sSegment;
+	OutlineList* outline = sOutline;
+	
+	sSegment = job->state.segment;
+	sOutline = job->outline;
+	decode_load(&job->state);
+	
+	/* the buffer replayed before this one leaves its own textures and
+	 * shader bound, so the first material has to be set up in full */
+	gMatState.mtlReady = 0;
+	gMatState.tile[0].doUpdate = true;
+	gMatState.tile[1].doUpdate = true;
+	
+	gBackend = job->backend;
+	cmdbuf_record(job->buf);
+	n64_draw_dlist(job->dlist);
+	decode_save(&job->state);
+	sSegment = segment;
+	sOutline = outline;
+	
+	return 0;
+}
+
+static void* flush_worker(void* arg) {
+	FlushJob** slot = arg;
+	
+	for (;;) {
+		FlushJob* job;
+		
+		pthread_mutex_lock(&sPool.lock);
+		while (!*slot)
+			pthread_cond_wait(&sPool.wake, &sPool.lock);
+		job = *slot;
+		pthread_mutex_unlock(&sPool.lock);
+		
+		flush_decode(job);
+		
+		pthread_mutex_lock(&sPool.lock);
+		*slot = 0;
+		sPool.pending -= 1;
+		pthread_cond_signal(&sPool.done);
+		pthread_mutex_unlock(&sPool.lock);
+	}
+	
+	return 0;
+}
+
+static void buffer_flush_threads(bool drawDecalsSeparately) {
+	const N64Backend* backend = gBackend;
+	FlushJob job[N64_ARRAY_COUNT(sFlushBuf)];
+	DecodeState start;
+	uint32_t num = 0;
+	
+	texel_init();
+	lights_upload();
+	decode_save(&start);
+	memcpy(start.segment, n64_segment, sizeof(start.segment));
+	
+	if (drawDecalsSeparately) {
+		// supports maps that have xlu on the opa layer
+		job[num].dlist = (void*)n64_poly_opa_head;
+		job[num++].state.zmode = N64_ZMODE_OPA | N64_ZMODE_INTER | N64_ZMODE_XLU;
+		
+		// decals
+		job[num].dlist = (void*)n64_poly_opa_head;
+		job[num++].state.zmode = N64_ZMODE_DEC;
+		
+		// draw xlu
+		job[num].dlist = (void*)n64_poly_xlu_head;
+		job[num++].state.zmode = N64_ZMODE_ALL;
+	} else {
+		job[num].dlist = (void*)n64_poly_opa_head;
+		job[num++].state.zmode = gOnlyThisZmode;
+		job[num].dlist = (void*)n64_poly_xlu_head;
+		job[num++].state.zmode = gOnlyThisZmode;
+	}
+	
+	for (uint32_t i = 0; i < num; ++i) {
+		enum N64ZMode zmode = job[i].state.zmode;
+		
+		job[i].state = start;
+		job[i].state.zmode = zmode;
+		job[i].buf = &sFlushBuf[i];
+		job[i].outline = sOutlineBuf[i];
+		job[i].backend = cmdbuf_begin(backend);
+		job[i].sorted = sSort && job[i].dlist == n64_poly_opa_head;
+	}
+	
+	/* this thread takes the first list itself */
+	sParallel = true;
+	pthread_mutex_lock(&sPool.lock);
+	for (uint32_t i = 1; i < num; ++i) {
+		if (!sPool.started[i - 1])
+			sPool.started[i - 1] = !pthread_create(&sPool.thread[i - 1], 0, flush_worker, &sPool.job[i - 1]);
+		if (sPool.started[i - 1]) {
+			sPool.job[i - 1] = &job[i];
+			sPool.pending += 1;
+		}
+	}
+	pthread_cond_broadcast(&sPool.wake);
+	pthread_mutex_unlock(&sPool.lock);
+	
+	flush_decode(&job[0]);
+	for (uint32_t i = 1; i < num; ++i) {
+		if (!sPool.started[i - 1])
+			flush_decode(&job[i]);
 	}
+	
+	pthread_mutex_lock(&sPool.lock);
+	while (sPool.pending)
+		pthread_cond_wait(&sPool.done, &sPool.lock);
+	pthread_mutex_unlock(&sPool.lock);
+	sParallel = false;
+	
+	gBackend = backend;
+	for (uint32_t i = 0; i < num; ++i) {
+		if (job[i].sorted) {
+			cmdbuf_end(&sFlushBuf[i], 1, sort_begin(backend));
+			sort_end();
+		} else
+			cmdbuf_end(&sFlushBuf[i], 1, backend);
+	}
+	
+	/* carry on from where the last list left off, like drawing in order would */
+	decode_load(&job[num - 1].state);
+	memcpy(n64_segment, job[num - 1].state.segment, sizeof(job[num - 1].state.segment));
+	state_forget();
+}
+
+bool n64_buffer_threads(bool state) {
+	return sThreads = state;
+}
+
+/* with n64_buffer_sort(true), the opaque layer (and the decals drawn from
+ * it) is drawn sorted by shader, textures, and render state, see n64sort.c;
+ * the translucent layer is always drawn in display list order */
+bool n64_buffer_sort(bool state) {
+	return sSort = state;
+}
+
+static void buffer_draw_opa(void) {
+	const N64Backend* backend = gBackend;
+	
+	if (!sSort) {
+		n64_draw_dlist(n64_poly_opa_head);
+		return;
+	}
+	
+	gBackend = sort_begin(backend);
+	n64_draw_dlist(n64_poly_opa_head);
+	gBackend = backend;
+	sort_end();
+	state_forget();
 }
 
 void n64_buffer_flush(bool drawDecalsSeparately)
 {
 	gSPEndDisplayList(POLY_OPA_DISP++);
 	gSPEndDisplayList(POLY_XLU_DISP++);
-	if (drawDecalsSeparately)
+	sOutlineDeferred = true;
+	if (sThreads && !sTraceCapture && !sStatsEnabled)
+		buffer_flush_threads(drawDecalsSeparately);
+	else if (drawDecalsSeparately)
 	{
 		// supports maps that have xlu on the opa layer
 		n64_set_onlyZmode(N64_ZMODE_OPA | N64_ZMODE_INTER | N64_ZMODE_XLU);
-		n64_draw_dlist(n64_poly_opa_head);
+		buffer_draw_opa();
 		
 		// decals
 		n64_set_onlyZmode(N64_ZMODE_DEC);
-		n64_draw_dlist(n64_poly_opa_head);
+		buffer_draw_opa();
 		
 		// draw xlu
 		n64_set_onlyZmode(N64_ZMODE_ALL);
@@ -2508,9 +4047,11 @@ void n64_buffer_flush(bool drawDecalsSeparately)
 	}
 	else
 	{
-		n64_draw_dlist(n64_poly_opa_head);
+		buffer_draw_opa();
 		n64_draw_dlist(n64_poly_xlu_head);
 	}
+	sOutlineDeferred = false;
+	outline_draw();
 	n64_buffer_clear();
 }
 
@@ -2557,6 +4098,7 @@ void n64_fog(int near, int far, uint8_t r, uint8_t g, uint8_t b) {
 static bool n64_bind_light(GbiLight* lightInfo, GbiLightAmbient* ambient) {
 	bool ret = EXIT_FAILURE;
 	
+	sLightsDirty = true;
 	if (lightInfo && sLightNum < 7)	{
 		sLights.l[sLightNum++] = *lightInfo;
 		ret = EXIT_SUCCESS;
@@ -2581,8 +4123,10 @@ bool n64_light_bind_dir(int8_t x, int8_t y, int8_t z, uint8_t r, uint8_t g, uint
 }
 
 bool n64_light_bind_point(int16_t x, int16_t y, int16_t z, uint8_t r, uint8_t g, uint8_t b) {
+	/* full intensity at the light, half at 256 units */
 	GbiLight light = {
-		.point.c   = 1,
+		.point.c   = 16,
+		.point.q   = 8,
 		.point.col = {
 			r, g, b
 		},
@@ -2611,7 +4155,378 @@ void n64_set_tri_callback(void* userData, N64TriCallback callback) {
 	s_tri_callback = callback;
 }
 
+/* called once per batch of triangles instead of once per triangle, which
+ * is cheaper when collecting whole scenes; the arrays are only valid
+ * during the call */
+void n64_set_tri_batch_callback(void* userData, N64TriBatchCallback callback) {
+	s_tri_batch_callback_data = userData;
+	s_tri_batch_callback = callback;
+}
+
 void n64_set_cull_callback(void* userData, N64CullCallback callback) {
 	s_cull_callback_data = userData;
 	s_cull_callback = callback;
 }
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* traces record every n64_draw_dlist() between n64_trace_begin() and
+ * n64_trace_end(), along with the matrices, lights, fog, and segment
+ * table it was called with, and a copy of each byte of memory the
+ * interpreter read (commands, vertices, matrices, textures, palettes);
+ * memory is copied the first time it is read, so a trace should not
+ * span edits to the scene it is capturing
+ *
+ * addresses are stored as-is and translated on replay, so trace files
+ * are only meant to be replayed by builds for the same architecture
+ */
+#define TRACE_MAGIC   "N64TRACE"
+#define TRACE_VERSION 1
+
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t drawSize;
+	uint32_t numDraws;
+	uint32_t numRanges;
+	uint32_t dataSize;
+} TraceHeader;
+
+static struct {
+	char*       filename;
+	TraceDraw*  draw;
+	uint32_t    numDraws;
+	uint32_t    maxDraws;
+	TraceRange* touch; /* in the order they were read */
+	uint32_t    numTouch;
+	uint32_t    maxTouch;
+	uint8_t*    pool;
+	uint32_t    poolSize;
+	uint32_t    poolMax;
+} sTrace;
+
+static void* trace_grow(void* array, uint32_t* max, uint32_t need, size_t size) {
+	if (need <= *max)
+		return array;
+	
+	while (*max < need)
+		*max = *max ? *max * 2 : 256;
+	
+	array = realloc(array, *max * size);
+	assert(array);
+	
+	return array;
+}
+
+static void trace_record(const void* data, uint32_t size) {
+	uint64_t addr = (uintptr_t)data;
+	TraceRange* last = sTrace.numTouch ? &sTrace.touch[sTrace.numTouch - 1] : 0;
+	
+	/* consecutive commands extend the previous range; its bytes are
+	 * always the last ones in the pool */
+	if (last && addr >= last->addr && addr <= last->addr + last->size) {
+		uint64_t skip = last->addr + last->size - addr;
+		
+		if (size <= skip)
+			return;
+		
+		addr += skip;
+		size -= skip;
+		last->size += size;
+	} else {
+		sTrace.touch = trace_grow(sTrace.touch, &sTrace.maxTouch, sTrace.numTouch + 1, sizeof(*sTrace.touch));
+		sTrace.touch[sTrace.numTouch++] = (TraceRange) { addr, size, sTrace.poolSize };
+	}
+	
+	sTrace.pool = trace_grow(sTrace.pool, &sTrace.poolMax, sTrace.poolSize + size, 1);
+	memcpy(sTrace.pool + sTrace.poolSize, (void*)(uintptr_t)addr, size);
+	sTrace.poolSize += size;
+}
+
+static void trace_draw(const void* dlist) {
+	TraceDraw* draw;
+	
+	sTrace.draw = trace_grow(sTrace.draw, &sTrace.maxDraws, sTrace.numDraws + 1, sizeof(*sTrace.draw));
+	draw = &sTrace.draw[sTrace.numDraws++];
+	memset(draw, 0, sizeof(*draw));
+	
+	draw->dlist = (uintptr_t)dlist;
+	for (int i = 0; i < N64_SEGMENT_MAX; ++i)
+		draw->segment[i] = (uintptr_t)n64_segment[i];
+	draw->view = gMatrix.view;
+	draw->normal = gMatrix.normal;
+	draw->projection = gMatrix.projection;
+	memcpy(draw->modelStack, gMatrix.modelStack, sizeof(draw->modelStack));
+	draw->modelNow = gMatrix.modelNow - gMatrix.modelStack;
+	memcpy(draw->fog, gFog.fog, sizeof(draw->fog));
+	memcpy(draw->fogColor, gFog.color, sizeof(draw->fogColor));
+	draw->lights = sLights;
+	draw->lightNum = sLightNum;
+	draw->zmode = gOnlyThisZmode;
+	draw->geoLayer = gOnlyThisGeoLayer;
+	draw->culling = s_cull_enabled;
+}
+
+static void trace_draw_restore(const TraceDraw* draw) {
+	for (int i = 0; i < N64_SEGMENT_MAX; ++i)
+		n64_segment[i] = (void*)(uintptr_t)draw->segment[i];
+	gMatrix.view = draw->view;
+	gMatrix.normal = draw->normal;
+	gMatrix.projection = draw->projection;
+	memcpy(gMatrix.modelStack, draw->modelStack, sizeof(gMatrix.modelStack));
+	gMatrix.modelNow = gMatrix.modelStack + draw->modelNow;
+	memcpy(gFog.fog, draw->fog, sizeof(gFog.fog));
+	memcpy(gFog.color, draw->fogColor, sizeof(gFog.color));
+	sLights = draw->lights;
+	sLightNum = draw->lightNum;
+	sLightsDirty = true;
+	gOnlyThisZmode = draw->zmode;
+	gOnlyThisGeoLayer = draw->geoLayer;
+	s_cull_enabled = draw->culling;
+}
+
+/* last range starting at or before addr, or -1 */
+static int trace_find(const TraceRange* range, uint32_t num, uint64_t addr) {
+	int lo = 0;
+	int hi = (int)num - 1;
+	int found = -1;
+	
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		
+		if (range[mid].addr <= addr) {
+			found = mid;
+			lo = mid + 1;
+		} else
+			hi = mid - 1;
+	}
+	
+	return found;
+}
+
+static void* trace_translate(const N64Trace* trace, const void* ptr) {
+	uint64_t addr = (uintptr_t)ptr;
+	int i;
+	
+	if (!ptr)
+		return 0;
+	
+	/* never read while capturing, and not valid in this process */
+	i = trace_find(trace->range, trace->numRanges, addr);
+	if (i < 0 || addr >= trace->range[i].addr + trace->range[i].size)
+		return 0;
+	
+	return trace->data + trace->range[i].offset + (addr - trace->range[i].addr);
+}
+
+/* interpreter state that carries over between display lists */
+static void trace_state_reset(void) {
+	memset(&gMatState, 0, sizeof(gMatState));
+	memset(sVbuf, 0, sizeof(sVbuf));
+	gSetId = 0;
+	gRdpHalf1 = 0;
+	gRdpHalf2 = 0;
+	gPtrHi = 0;
+	gPtrHiSet = false;
+	gShader = 0;
+	gIndicesUsed = 0;
+	gHideGeometry = false;
+	gVertexColors = false;
+	gFogEnabled = true;
+	gForceBl = false;
+	gCvgXalpha = false;
+	gGxOutline = false;
+	gPolygonOffset = 0;
+	gCurrentZmode = 0;
+	gFilterMode = N64_FILTER_LINEAR;
+}
+
+static void trace_cleanup(void) {
+	free(sTrace.filename);
+	free(sTrace.draw);
+	free(sTrace.touch);
+	free(sTrace.pool);
+	memset(&sTrace, 0, sizeof(sTrace));
+}
+
+static int trace_cmp_addr(const void* a, const void* b) {
+	const TraceRange* ra = a;
+	const TraceRange* rb = b;
+	
+	if (ra->addr != rb->addr)
+		return ra->addr < rb->addr ? -1 : 1;
+	
+	return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+static int trace_cmp_latest(const void* a, const void* b) {
+	const TraceRange* ra = a;
+	const TraceRange* rb = b;
+	
+	return (ra->offset < rb->offset) - (ra->offset > rb->offset);
+}
+
+bool n64_trace_begin(const char* filename) {
+	if (sTraceCapture || sTraceReplay || !filename)
+		return EXIT_FAILURE;
+	
+	/* textures already in the cache wouldn't be read again */
+	n64_clear_cache();
+	trace_state_reset();
+	
+	sTrace.filename = strdup(filename);
+	sTraceCapture = true;
+	
+	return EXIT_SUCCESS;
+}
+
+bool n64_trace_end(void) {
+	N64Trace trace = { 0 };
+	TraceHeader header = { 0 };
+	TraceRange* sorted;
+	bool ret = EXIT_FAILURE;
+	FILE* fp;
+	
+	if (!sTraceCapture)
+		return EXIT_FAILURE;
+	sTraceCapture = false;
+	
+	/* merge everything that was read into non-overlapping ranges */
+	sorted = malloc(sizeof(*sorted) * (sTrace.numTouch + 1));
+	trace.range = malloc(sizeof(*trace.range) * (sTrace.numTouch + 1));
+	assert(sorted && trace.range);
+	memcpy(sorted, sTrace.touch, sizeof(*sorted) * sTrace.numTouch);
+	qsort(sorted, sTrace.numTouch, sizeof(*sorted), trace_cmp_addr);
+	
+	for (uint32_t i = 0; i < sTrace.numTouch; ++i) {
+		TraceRange* last = trace.numRanges ? &trace.range[trace.numRanges - 1] : 0;
+		uint64_t end = sorted[i].addr + sorted[i].size;
+		
+		if (last && sorted[i].addr <= last->addr + last->size) {
+			if (end > last->addr + last->size) {
+				trace.dataSize += end - (last->addr + last->size);
+				last->size = end - last->addr;
+			}
+			continue;
+		}
+		
+		trace.range[trace.numRanges++] = (TraceRange) { sorted[i].addr, sorted[i].size, trace.dataSize };
+		trace.dataSize += sorted[i].size;
+	}
+	
+	/* where reads overlap, keep the bytes that were read first */
+	trace.data = malloc(trace.dataSize + 1);
+	assert(trace.data);
+	qsort(sorted, sTrace.numTouch, sizeof(*sorted), trace_cmp_latest);
+	for (uint32_t i = 0; i < sTrace.numTouch; ++i) {
+		memcpy(
+			trace_translate(&trace, (void*)(uintptr_t)sorted[i].addr),
+			sTrace.pool + sorted[i].offset,
+			sorted[i].size
+		);
+	}
+	
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.drawSize = sizeof(TraceDraw);
+	header.numDraws = sTrace.numDraws;
+	header.numRanges = trace.numRanges;
+	header.dataSize = trace.dataSize;
+	
+	if ((fp = fopen(sTrace.filename, "wb"))) {
+		if (fwrite(&header, sizeof(header), 1, fp) == 1
+			&& fwrite(sTrace.draw, sizeof(*sTrace.draw), sTrace.numDraws, fp) == sTrace.numDraws
+			&& fwrite(trace.range, sizeof(*trace.range), trace.numRanges, fp) == trace.numRanges
+			&& fwrite(trace.data, 1, trace.dataSize, fp) == trace.dataSize
+		)
+			ret = EXIT_SUCCESS;
+		if (fclose(fp))
+			ret = EXIT_FAILURE;
+	}
+	
+	if (ret)
+		fprintf(stderr, "failed to write trace '%s'\n", sTrace.filename);
+	
+	free(sorted);
+	free(trace.range);
+	free(trace.data);
+	trace_cleanup();
+	
+	return ret;
+}
+
+N64Trace* n64_trace_load(const char* filename) {
+	TraceHeader header;
+	N64Trace* trace;
+	FILE* fp;
+	
+	if (!(fp = fopen(filename, "rb")))
+		return 0;
+	
+	if (fread(&header, sizeof(header), 1, fp) != 1
+		|| memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))
+		|| header.version != TRACE_VERSION
+		|| header.drawSize != sizeof(TraceDraw)
+	) {
+		fprintf(stderr, "'%s' is not a trace this build can replay\n", filename);
+		fclose(fp);
+		return 0;
+	}
+	
+	trace = calloc(1, sizeof(*trace));
+	assert(trace);
+	trace->numDraws = header.numDraws;
+	trace->numRanges = header.numRanges;
+	trace->dataSize = header.dataSize;
+	trace->draw = malloc(sizeof(*trace->draw) * (trace->numDraws + 1));
+	trace->range = malloc(sizeof(*trace->range) * (trace->numRanges + 1));
+	trace->data = malloc(trace->dataSize + 1);
+	assert(trace->draw && trace->range && trace->data);
+	
+	if (fread(trace->draw, sizeof(*trace->draw), trace->numDraws, fp) != trace->numDraws
+		|| fread(trace->range, sizeof(*trace->range), trace->numRanges, fp) != trace->numRanges
+		|| fread(trace->data, 1, trace->dataSize, fp) != trace->dataSize
+	) {
+		fprintf(stderr, "trace '%s' is truncated\n", filename);
+		n64_trace_free(trace);
+		trace = 0;
+	}
+	fclose(fp);
+	
+	/* replayed memory may land on addresses the texture cache has seen */
+	if (trace)
+		n64_clear_cache();
+	
+	return trace;
+}
+
+void n64_trace_replay(const N64Trace* trace) {
+	if (!trace || sTraceCapture)
+		return;
+	
+	trace_state_reset();
+	sTraceReplay = trace;
+	
+	for (uint32_t i = 0; i < trace->numDraws; ++i) {
+		const TraceDraw* draw = &trace->draw[i];
+		
+		trace_draw_restore(draw);
+		n64_draw_dlist(trace_translate(trace, (void*)(uintptr_t)draw->dlist));
+	}
+	
+	sTraceReplay = 0;
+	
+	/* these point into memory that was captured, not replayed */
+	for (int i = 0; i < N64_SEGMENT_MAX; ++i)
+		n64_segment[i] = NULL;
+}
+
+void n64_trace_free(N64Trace* trace) {
+	if (!trace)
+		return;
+	
+	free(trace->draw);
+	free(trace->range);
+	free(trace->data);
+	free(trace);
+}
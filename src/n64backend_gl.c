@@ -0,0 +1,753 @@
+/*
+ * n64backend_gl.c <z64.me>
+ *
+ * OpenGL 3.3 implementation of the n64 render backend
+ *
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <glad/glad.h>
+#include <n64backend.h>
+
+/* streaming vertices and indices are appended to a ring buffer each,
+ * written unsynchronized and only orphaned when they wrap around, and
+ * vertices are only written once a draw needs them; indices are rebased
+ * to where their vertices landed, as the GL 3.1 loader has no base vertex
+ * draws; 16 bits is enough, as even GlVtx only fits 37449 times */
+#define GL_RING_SIZE (1 << 20)
+
+/* draws are held back and merged with the ones after them until
+ * something they depend on changes, so every state change submits
+ * them first; uniforms and texture parameters that are set to what
+ * they already are don't count, as n64.c sets them per material */
+#define GL_BATCH_VTX      4096
+#define GL_BATCH_IDX      (GL_BATCH_VTX * 4)
+#define GL_UNIFORM_CACHE  512
+#define GL_TEXPARAM_CACHE 256
+
+typedef struct {
+	GLuint   buf;
+	GLenum   target;
+	uint32_t offset;
+} GlRing;
+
+/* mesh handles are an index into gMesh plus one, so 0 is no mesh */
+typedef struct {
+	GLuint vao;
+	GLuint buf[2]; /* vertices, indices */
+} GlMesh;
+
+static GLuint gVAO;
+static GlMesh* gMesh;
+static uint32_t gMeshNum;
+static GlRing gVBO = { .target = GL_ARRAY_BUFFER, .offset = GL_RING_SIZE };
+static GlRing gEBO = { .target = GL_ELEMENT_ARRAY_BUFFER, .offset = GL_RING_SIZE };
+static GLuint gUBO[4];
+static bool gPackedAttribs;
+static bool gPack; /* n64_backend_gl_packed */
+
+/* last vertices() call */
+static N64Vtx gVtx[N64_VBUF_MAX];
+static uint32_t gVtxNum;
+
+/* triangles waiting to be drawn, and the vertices they use */
+static struct {
+	N64Vtx   vtx[GL_BATCH_VTX];
+	uint16_t idx[GL_BATCH_IDX];
+	uint32_t numVtx;
+	uint32_t numIdx;
+	int16_t  slot[N64_VBUF_MAX]; /* where each of gVtx is in vtx, or -1 */
+} gBatch = { .slot = { [0 ... N64_VBUF_MAX - 1] = -1 } };
+
+typedef struct {
+	Shader*     shader;
+	const char* name; /* string literals, like n64cmd.c */
+	uint32_t    size;
+	float       v[16];
+} GlUniform;
+
+typedef struct {
+	uint32_t tex;
+	int8_t   filter;
+	int8_t   wrapS;
+	int8_t   wrapT;
+} GlTexParam;
+
+static GlUniform gUniform[GL_UNIFORM_CACHE];
+static GlTexParam gTexParam[GL_TEXPARAM_CACHE];
+static uint32_t gTexBound[8];
+static int gTexUnit;
+static Shader* gProgram;
+
+/* streaming vertex for n64_backend_gl_packed, 28 bytes to N64Vtx's 60
+ *
+ * positions stay in world space, because the interpreter transforms them
+ * (one load of the vertex buffer can mix vertices from several matrices),
+ * texture coordinates are the raw s/t that the shader scales, and colors
+ * and normals become normalized bytes; the shaders read either layout */
+typedef struct {
+	float   pos[3];
+	int16_t texcoord0[2];
+	int16_t texcoord1[2];
+	uint8_t color[4];
+	int8_t  norm[4];
+} GlVtx;
+
+static const GLenum sCullMode[] = {
+	[N64_CULL_FRONT] = GL_FRONT,
+	[N64_CULL_BACK] = GL_BACK,
+	[N64_CULL_FRONT_AND_BACK] = GL_FRONT_AND_BACK,
+};
+
+static const GLint sFilter[] = {
+	[N64_FILTER_NEAREST] = GL_NEAREST,
+	[N64_FILTER_LINEAR] = GL_LINEAR,
+};
+
+static const GLint sWrap[] = {
+	[N64_WRAP_REPEAT] = GL_REPEAT,
+	[N64_WRAP_MIRRORED_REPEAT] = GL_MIRRORED_REPEAT,
+	[N64_WRAP_CLAMP] = GL_CLAMP_TO_EDGE,
+};
+
+static void toggle(GLenum cap, bool enable) {
+	if (enable)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* vertex layout shared by the streaming buffer and baked meshes */
+static void gl_attribs(void) {
+	/* pos */
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, pos));
+	glEnableVertexAttribArray(0);
+	
+	/* color */
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, color));
+	glEnableVertexAttribArray(1);
+	
+	/* texcoord0 */
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, texcoord0));
+	glEnableVertexAttribArray(2);
+	
+	/* texcoord1 */
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, texcoord1));
+	glEnableVertexAttribArray(3);
+	
+	/* normal (inverse hull outlines) */
+	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(N64Vtx), (void*)offsetof(N64Vtx, norm));
+	glEnableVertexAttribArray(4);
+}
+
+static void gl_attribs_packed(void) {
+	/* pos; w is always 1 */
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GlVtx), (void*)offsetof(GlVtx, pos));
+	glEnableVertexAttribArray(0);
+	
+	/* color */
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GlVtx), (void*)offsetof(GlVtx, color));
+	glEnableVertexAttribArray(1);
+	
+	/* texcoord0 */
+	glVertexAttribPointer(2, 2, GL_SHORT, GL_FALSE, sizeof(GlVtx), (void*)offsetof(GlVtx, texcoord0));
+	glEnableVertexAttribArray(2);
+	
+	/* texcoord1 */
+	glVertexAttribPointer(3, 2, GL_SHORT, GL_FALSE, sizeof(GlVtx), (void*)offsetof(GlVtx, texcoord1));
+	glEnableVertexAttribArray(3);
+	
+	/* normal */
+	glVertexAttribPointer(4, 3, GL_BYTE, GL_TRUE, sizeof(GlVtx), (void*)offsetof(GlVtx, norm));
+	glEnableVertexAttribArray(4);
+}
+
+static bool gl_pack_st(int16_t* dst, float s, float t) {
+	if (!(s >= INT16_MIN && s <= INT16_MAX && t >= INT16_MIN && t <= INT16_MAX))
+		return false;
+	
+	dst[0] = s;
+	dst[1] = t;
+	
+	return dst[0] == s && dst[1] == t;
+}
+
+static uint8_t gl_pack_unorm(float v) {
+	return N64_CLAMP(v, 0.0f, 1.0f) * 255.0f + 0.5f;
+}
+
+static int8_t gl_pack_snorm(float v) {
+	return lrintf(N64_CLAMP(v, -1.0f, 1.0f) * 127.0f);
+}
+
+/* false if anything wouldn't survive packing, like texgen coordinates */
+static bool gl_pack(GlVtx* dst, const N64Vtx* vtx, uint32_t num) {
+	for (; num--; dst++, vtx++) {
+		if (vtx->pos.w != 1.0f)
+			return false;
+		if (!gl_pack_st(dst->texcoord0, vtx->texcoord0.u, vtx->texcoord0.v))
+			return false;
+		if (!gl_pack_st(dst->texcoord1, vtx->texcoord1.u, vtx->texcoord1.v))
+			return false;
+		
+		dst->pos[0] = vtx->pos.x;
+		dst->pos[1] = vtx->pos.y;
+		dst->pos[2] = vtx->pos.z;
+		dst->color[0] = gl_pack_unorm(vtx->color.x);
+		dst->color[1] = gl_pack_unorm(vtx->color.y);
+		dst->color[2] = gl_pack_unorm(vtx->color.z);
+		dst->color[3] = gl_pack_unorm(vtx->color.w);
+		dst->norm[0] = gl_pack_snorm(vtx->norm.x);
+		dst->norm[1] = gl_pack_snorm(vtx->norm.y);
+		dst->norm[2] = gl_pack_snorm(vtx->norm.z);
+		dst->norm[3] = 0;
+	}
+	
+	return true;
+}
+
+/* reserves size bytes aligned to align, and returns their offset */
+static uint32_t gl_ring_write(GlRing* ring, const void* data, uint32_t size, uint32_t align) {
+	uint32_t at = (ring->offset + align - 1) / align * align;
+	void* dst;
+	
+	glBindBuffer(ring->target, ring->buf);
+	if (at + size > GL_RING_SIZE) {
+		glBufferData(ring->target, GL_RING_SIZE, 0, GL_STREAM_DRAW);
+		at = 0;
+	}
+	ring->offset = at + size;
+	
+	dst = glMapBufferRange(ring->target, at, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (dst) {
+		memcpy(dst, data, size);
+		glUnmapBuffer(ring->target);
+	} else
+		glBufferSubData(ring->target, at, size, data);
+	
+	return at;
+}
+
+/* draws the held back triangles with one call */
+static void gl_flush(void) {
+	static GlVtx packed[GL_BATCH_VTX];
+	uint32_t num = gBatch.numVtx;
+	bool pack;
+	uint32_t stride;
+	uint32_t at;
+	
+	if (!gBatch.numIdx)
+		return;
+	
+	pack = gPack && gl_pack(packed, gBatch.vtx, num);
+	stride = pack ? sizeof(*packed) : sizeof(*gBatch.vtx);
+	if (pack)
+		at = gl_ring_write(&gVBO, packed, stride * num, stride);
+	else
+		at = gl_ring_write(&gVBO, gBatch.vtx, stride * num, stride);
+	
+	if (pack != gPackedAttribs) {
+		if (pack)
+			gl_attribs_packed();
+		else
+			gl_attribs();
+		gPackedAttribs = pack;
+	}
+	
+	for (uint32_t i = 0; i < gBatch.numIdx; ++i)
+		gBatch.idx[i] += at / stride;
+	at = gl_ring_write(&gEBO, gBatch.idx, sizeof(*gBatch.idx) * gBatch.numIdx, sizeof(*gBatch.idx));
+	glDrawElements(GL_TRIANGLES, gBatch.numIdx, GL_UNSIGNED_SHORT, (void*)(uintptr_t)at);
+	
+	gBatch.numVtx = 0;
+	gBatch.numIdx = 0;
+	memset(gBatch.slot, 0xff, sizeof(gBatch.slot));
+}
+
+static void gl_begin(void) {
+	gl_flush();
+	glDepthFunc(GL_LESS);
+	
+	if (!gVAO)
+		glGenVertexArrays(1, &gVAO);
+	if (!gVBO.buf)
+		glGenBuffers(1, &gVBO.buf);
+	if (!gEBO.buf)
+		glGenBuffers(1, &gEBO.buf);
+	
+	/* set up geometry stuff */
+	glBindVertexArray(gVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, gVBO.buf);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gEBO.buf);
+	gl_attribs();
+	gPackedAttribs = false;
+	gPack = false;
+	
+	/* the host may have changed these since the last display list */
+	memset(gTexParam, 0, sizeof(gTexParam));
+	memset(gTexBound, 0xff, sizeof(gTexBound));
+	gTexUnit = -1;
+}
+
+static void gl_begin_packed(void) {
+	gl_begin();
+	gPack = true;
+}
+
+static void gl_end(void) {
+	gl_flush();
+}
+
+static void gl_vertices(const N64Vtx* vtx, uint32_t num) {
+	num = num < N64_VBUF_MAX ? num : N64_VBUF_MAX;
+	
+	/* vertices that didn't change are still in the batch */
+	for (uint32_t i = 0; i < N64_VBUF_MAX; ++i) {
+		if (gBatch.slot[i] >= 0 && (i >= num || memcmp(&gVtx[i], &vtx[i], sizeof(*vtx))))
+			gBatch.slot[i] = -1;
+	}
+	
+	gVtxNum = num;
+	memcpy(gVtx, vtx, sizeof(*vtx) * gVtxNum);
+}
+
+static void gl_draw_triangles(const uint8_t* indices, uint32_t num) {
+	if (!num || !gVtxNum)
+		return;
+	
+	if (gBatch.numVtx + num > GL_BATCH_VTX || gBatch.numIdx + num > GL_BATCH_IDX)
+		gl_flush();
+	
+	for (uint32_t i = 0; i < num; ++i) {
+		uint8_t v = indices[i] < gVtxNum ? indices[i] : gVtxNum - 1;
+		
+		if (gBatch.slot[v] < 0) {
+			gBatch.slot[v] = gBatch.numVtx;
+			gBatch.vtx[gBatch.numVtx++] = gVtx[v];
+		}
+		gBatch.idx[gBatch.numIdx++] = gBatch.slot[v];
+	}
+}
+
+// inverse hull method; n64.c binds the outline shader and sets the state
+static void gl_draw_outline(const N64Vtx* vtx, uint32_t num) {
+	const uint32_t chunk = GL_RING_SIZE / sizeof(*vtx) / 3 * 3;
+	
+	gl_flush();
+	
+	while (num) {
+		uint32_t n = num < chunk ? num : chunk;
+		uint32_t at = gl_ring_write(&gVBO, vtx, sizeof(*vtx) * n, sizeof(*vtx));
+		
+		if (gPackedAttribs) {
+			gl_attribs();
+			gPackedAttribs = false;
+		}
+		
+		glDrawArrays(GL_TRIANGLES, at / sizeof(*vtx), n);
+		vtx += n;
+		num -= n;
+	}
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* a mesh is a vertex array object that owns its vertex and index buffers */
+static uint32_t gl_mesh_new(const N64Vtx* vtx, uint32_t numVtx, const uint32_t* indices, uint32_t numIndices) {
+	GlMesh* mesh;
+	uint32_t i;
+	
+	/* reuse the slot of a deleted mesh */
+	for (i = 0; i < gMeshNum; ++i) {
+		if (!gMesh[i].vao)
+			break;
+	}
+	if (i == gMeshNum) {
+		gMesh = realloc(gMesh, sizeof(*gMesh) * (gMeshNum + 1));
+		assert(gMesh);
+		gMeshNum += 1;
+	}
+	mesh = &gMesh[i];
+	
+	gl_flush();
+	glGenVertexArrays(1, &mesh->vao);
+	glGenBuffers(2, mesh->buf);
+	
+	glBindVertexArray(mesh->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->buf[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(*vtx) * numVtx, vtx, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->buf[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(*indices) * numIndices, indices, GL_STATIC_DRAW);
+	gl_attribs();
+	
+	glBindVertexArray(gVAO);
+	
+	return i + 1;
+}
+
+static void gl_mesh_draw(uint32_t mesh, uint32_t first, uint32_t num) {
+	if (!mesh || mesh > gMeshNum)
+		return;
+	
+	gl_flush();
+	glBindVertexArray(gMesh[mesh - 1].vao);
+	glDrawElements(GL_TRIANGLES, num, GL_UNSIGNED_INT, (void*)(sizeof(uint32_t) * first));
+	glBindVertexArray(gVAO);
+}
+
+static void gl_mesh_delete(uint32_t mesh) {
+	GlMesh* m;
+	
+	if (!mesh || mesh > gMeshNum)
+		return;
+	
+	m = &gMesh[mesh - 1];
+	gl_flush();
+	glDeleteBuffers(2, m->buf);
+	glDeleteVertexArrays(1, &m->vao);
+	memset(m, 0, sizeof(*m));
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void gl_blend(bool enable) {
+	gl_flush();
+	toggle(GL_BLEND, enable);
+	
+	if (enable)
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+static void gl_depth_test(bool enable) {
+	gl_flush();
+	toggle(GL_DEPTH_TEST, enable);
+}
+
+static void gl_depth_mask(bool enable) {
+	gl_flush();
+	glDepthMask(enable);
+}
+
+static void gl_cull(enum N64Cull mode) {
+	gl_flush();
+	if (mode == N64_CULL_NONE) {
+		glDisable(GL_CULL_FACE);
+		return;
+	}
+	
+	glEnable(GL_CULL_FACE);
+	glCullFace(sCullMode[mode]);
+}
+
+static void gl_polygon_offset(float factor, float units) {
+	gl_flush();
+	glPolygonOffset(factor, units);
+}
+
+static void gl_polygon_offset_fill(bool enable) {
+	gl_flush();
+	toggle(GL_POLYGON_OFFSET_FILL, enable);
+}
+
+static void gl_polygon_offset_line(bool enable) {
+	gl_flush();
+	toggle(GL_POLYGON_OFFSET_LINE, enable);
+}
+
+static void gl_wireframe(bool enable) {
+	gl_flush();
+	glPolygonMode(GL_FRONT_AND_BACK, enable ? GL_LINE : GL_FILL);
+}
+
+static void gl_stencil(bool enable) {
+	gl_flush();
+	toggle(GL_STENCIL_TEST, enable);
+	
+	if (enable)
+		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static uint32_t gl_texture_new(void) {
+	GLuint tex = 0;
+	
+	glGenTextures(1, &tex);
+	
+	return tex;
+}
+
+static void gl_texture_delete(uint32_t tex) {
+	GLuint id = tex;
+	
+	if (!id)
+		return;
+	
+	gl_flush();
+	glDeleteTextures(1, &id);
+	gTexParam[tex % GL_TEXPARAM_CACHE].tex = 0;
+	for (uint32_t i = 0; i < N64_ARRAY_COUNT(gTexBound); ++i) {
+		if (gTexBound[i] == tex)
+			gTexBound[i] = 0;
+	}
+}
+
+static void gl_texture_bind(int unit, uint32_t tex) {
+	if (unit != gTexUnit)
+		glActiveTexture(GL_TEXTURE0 + unit);
+	gTexUnit = unit;
+	
+	if (unit < N64_ARRAY_COUNT(gTexBound)) {
+		if (gTexBound[unit] == tex)
+			return;
+		gTexBound[unit] = tex;
+	}
+	
+	gl_flush();
+	glBindTexture(GL_TEXTURE_2D, tex);
+}
+
+/* the cached parameters of the bound texture */
+static GlTexParam* gl_texparam(void) {
+	static GlTexParam none;
+	uint32_t tex;
+	GlTexParam* p;
+	
+	if (gTexUnit < 0 || gTexUnit >= N64_ARRAY_COUNT(gTexBound) || !(tex = gTexBound[gTexUnit]) || tex == UINT32_MAX) {
+		none = (GlTexParam) { .filter = -1, .wrapS = -1, .wrapT = -1 };
+		return &none;
+	}
+	
+	p = &gTexParam[tex % GL_TEXPARAM_CACHE];
+	if (p->tex != tex)
+		*p = (GlTexParam) { tex, -1, -1, -1 };
+	
+	return p;
+}
+
+static void gl_texture_filter(enum N64Filter filter) {
+	GlTexParam* p = gl_texparam();
+	
+	if (p->filter == filter)
+		return;
+	p->filter = filter;
+	
+	gl_flush();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sFilter[filter]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sFilter[filter]);
+}
+
+static void gl_texture_wrap(enum N64Wrap s, enum N64Wrap t) {
+	GlTexParam* p = gl_texparam();
+	
+	if (p->wrapS == s && p->wrapT == t)
+		return;
+	p->wrapS = s;
+	p->wrapT = t;
+	
+	gl_flush();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sWrap[s]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sWrap[t]);
+}
+
+static void gl_texture_upload(int width, int height, const void* rgba8888) {
+	gl_flush();
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba8888);
+	//glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* false if the uniform already has this value */
+static bool gl_uniform(Shader* s, const char* name, const void* v, uint32_t size) {
+	uint32_t h = (uintptr_t)s >> 4;
+	GlUniform* u;
+	
+	for (const char* c = name; *c; ++c)
+		h = h * 31 + *c;
+	u = &gUniform[h % GL_UNIFORM_CACHE];
+	
+	if (u->name && u->shader == s && u->size == size && !strcmp(u->name, name) && !memcmp(u->v, v, size))
+		return false;
+	
+	gl_flush();
+	u->shader = s;
+	u->name = name;
+	u->size = size;
+	memcpy(u->v, v, size);
+	
+	return true;
+}
+
+/* linking resets a program's uniforms */
+static void gl_uniform_forget(Shader* s) {
+	for (uint32_t i = 0; i < GL_UNIFORM_CACHE; ++i) {
+		if (gUniform[i].shader == s)
+			gUniform[i].shader = 0;
+	}
+}
+
+static void gl_shader_update(Shader* s, const char* vs, const char* fs) {
+	gl_flush();
+	gl_uniform_forget(s);
+	Shader_update(s, vs, fs);
+}
+
+static bool gl_shader_use(Shader* s) {
+	if (s != gProgram)
+		gl_flush();
+	gProgram = s;
+	
+	return Shader_use(s);
+}
+
+static void gl_shader_delete(Shader* s) {
+	gl_flush();
+	gl_uniform_forget(s);
+	if (s == gProgram)
+		gProgram = 0;
+	Shader_delete(s);
+}
+
+static void gl_shader_mat4(Shader* s, const char* name, const void* m) {
+	if (gl_uniform(s, name, m, sizeof(float[16])))
+		Shader_setMat4(s, name, m);
+}
+
+static void gl_shader_vec2(Shader* s, const char* name, float v0, float v1) {
+	if (gl_uniform(s, name, (float[]) { v0, v1 }, sizeof(float[2])))
+		Shader_setVec2(s, name, v0, v1);
+}
+
+static void gl_shader_vec3(Shader* s, const char* name, float v0, float v1, float v2) {
+	if (gl_uniform(s, name, (float[]) { v0, v1, v2 }, sizeof(float[3])))
+		Shader_setVec3(s, name, v0, v1, v2);
+}
+
+static void gl_shader_vec4(Shader* s, const char* name, float v0, float v1, float v2, float v3) {
+	if (gl_uniform(s, name, (float[]) { v0, v1, v2, v3 }, sizeof(float[4])))
+		Shader_setVec4(s, name, v0, v1, v2, v3);
+}
+
+static void gl_shader_int(Shader* s, const char* name, int v) {
+	if (gl_uniform(s, name, &v, sizeof(v)))
+		Shader_setInt(s, name, v);
+}
+
+static void gl_shader_float(Shader* s, const char* name, float v) {
+	if (gl_uniform(s, name, &v, sizeof(v)))
+		Shader_setFloat(s, name, v);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void gl_uniform_block(int binding, const void* data, uint32_t size) {
+	if (binding >= N64_ARRAY_COUNT(gUBO))
+		return;
+	
+	gl_flush();
+	if (!gUBO[binding])
+		glGenBuffers(1, &gUBO[binding]);
+	
+	glBindBuffer(GL_UNIFORM_BUFFER, gUBO[binding]);
+	glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, gUBO[binding]);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+const N64Backend n64_backend_gl = {
+	.name = "gl",
+	
+	.begin = gl_begin,
+	.end = gl_end,
+	
+	.vertices = gl_vertices,
+	.draw_triangles = gl_draw_triangles,
+	.draw_outline = gl_draw_outline,
+	
+	.mesh_new = gl_mesh_new,
+	.mesh_draw = gl_mesh_draw,
+	.mesh_delete = gl_mesh_delete,
+	
+	.blend = gl_blend,
+	.depth_test = gl_depth_test,
+	.depth_mask = gl_depth_mask,
+	.cull = gl_cull,
+	.polygon_offset = gl_polygon_offset,
+	.polygon_offset_fill = gl_polygon_offset_fill,
+	.polygon_offset_line = gl_polygon_offset_line,
+	.wireframe = gl_wireframe,
+	.stencil = gl_stencil,
+	
+	.texture_new = gl_texture_new,
+	.texture_delete = gl_texture_delete,
+	.texture_bind = gl_texture_bind,
+	.texture_filter = gl_texture_filter,
+	.texture_wrap = gl_texture_wrap,
+	.texture_upload = gl_texture_upload,
+	
+	.shader_new = Shader_new,
+	.shader_update = gl_shader_update,
+	.shader_use = gl_shader_use,
+	.shader_delete = gl_shader_delete,
+	.shader_mat4 = gl_shader_mat4,
+	.shader_vec2 = gl_shader_vec2,
+	.shader_vec3 = gl_shader_vec3,
+	.shader_vec4 = gl_shader_vec4,
+	.shader_int = gl_shader_int,
+	.shader_float = gl_shader_float,
+	
+	.uniform_block = gl_uniform_block,
+};
+
+const N64Backend n64_backend_gl_packed = {
+	.name = "gl_packed",
+	
+	.begin = gl_begin_packed,
+	.end = gl_end,
+	
+	.vertices = gl_vertices,
+	.draw_triangles = gl_draw_triangles,
+	.draw_outline = gl_draw_outline,
+	
+	.mesh_new = gl_mesh_new,
+	.mesh_draw = gl_mesh_draw,
+	.mesh_delete = gl_mesh_delete,
+	
+	.blend = gl_blend,
+	.depth_test = gl_depth_test,
+	.depth_mask = gl_depth_mask,
+	.cull = gl_cull,
+	.polygon_offset = gl_polygon_offset,
+	.polygon_offset_fill = gl_polygon_offset_fill,
+	.polygon_offset_line = gl_polygon_offset_line,
+	.wireframe = gl_wireframe,
+	.stencil = gl_stencil,
+	
+	.texture_new = gl_texture_new,
+	.texture_delete = gl_texture_delete,
+	.texture_bind = gl_texture_bind,
+	.texture_filter = gl_texture_filter,
+	.texture_wrap = gl_texture_wrap,
+	.texture_upload = gl_texture_upload,
+	
+	.shader_new = Shader_new,
+	.shader_update = gl_shader_update,
+	.shader_use = gl_shader_use,
+	.shader_delete = gl_shader_delete,
+	.shader_mat4 = gl_shader_mat4,
+	.shader_vec2 = gl_shader_vec2,
+	.shader_vec3 = gl_shader_vec3,
+	.shader_vec4 = gl_shader_vec4,
+	.shader_int = gl_shader_int,
+	.shader_float = gl_shader_float,
+	
+	.uniform_block = gl_uniform_block,
+};
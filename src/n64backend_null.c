@@ -0,0 +1,228 @@
+/*
+ * n64backend_null.c <z64.me>
+ *
+ * render backend that submits nothing; it only counts what it was
+ * asked to do, so the cpu side of display list processing can be
+ * benchmarked on machines without a gpu
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <n64backend.h>
+
+static N64NullStats sStats;
+static uint32_t sTextureCount;
+static uint32_t sMeshCount;
+static Shader* sShaderNow;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void null_begin(void) {
+	sStats.begins += 1;
+}
+
+static void null_end(void) {
+}
+
+static void null_vertices(const N64Vtx* vtx, uint32_t num) {
+	sStats.vertexUploads += 1;
+	sStats.vertices += num;
+}
+
+static void null_draw_triangles(const uint8_t* indices, uint32_t num) {
+	sStats.draws += 1;
+	sStats.triangles += num / 3;
+}
+
+static void null_draw_outline(const N64Vtx* vtx, uint32_t num) {
+	sStats.outlineDraws += 1;
+}
+
+static uint32_t null_mesh_new(const N64Vtx* vtx, uint32_t numVtx, const uint32_t* indices, uint32_t numIndices) {
+	sStats.meshes += 1;
+	sStats.vertexUploads += 1;
+	sStats.vertices += numVtx;
+	
+	return ++sMeshCount;
+}
+
+static void null_mesh_draw(uint32_t mesh, uint32_t first, uint32_t num) {
+	sStats.meshDraws += 1;
+	sStats.draws += 1;
+	sStats.triangles += num / 3;
+}
+
+static void null_mesh_delete(uint32_t mesh) {
+	if (mesh)
+		sStats.meshes -= 1;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void null_state_bool(bool enable) {
+	sStats.stateChanges += 1;
+}
+
+static void null_cull(enum N64Cull mode) {
+	sStats.stateChanges += 1;
+}
+
+static void null_polygon_offset(float factor, float units) {
+	sStats.stateChanges += 1;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static uint32_t null_texture_new(void) {
+	sStats.textures += 1;
+	
+	return ++sTextureCount;
+}
+
+static void null_texture_delete(uint32_t tex) {
+	if (tex)
+		sStats.textures -= 1;
+}
+
+static void null_texture_bind(int unit, uint32_t tex) {
+	sStats.textureBinds += 1;
+}
+
+static void null_texture_filter(enum N64Filter filter) {
+	sStats.stateChanges += 1;
+}
+
+static void null_texture_wrap(enum N64Wrap s, enum N64Wrap t) {
+	sStats.stateChanges += 1;
+}
+
+static void null_texture_upload(int width, int height, const void* rgba8888) {
+	sStats.textureUploads += 1;
+	sStats.texelBytes += width * height * 4;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static Shader* null_shader_new(void) {
+	sStats.shaders += 1;
+	
+	/* never dereferenced, only needs to be unique */
+	return malloc(1);
+}
+
+static void null_shader_update(Shader* s, const char* vs, const char* fs) {
+	sStats.shaderCompiles += 1;
+}
+
+static bool null_shader_use(Shader* s) {
+	if (s == sShaderNow)
+		return false;
+	
+	sShaderNow = s;
+	sStats.shaderBinds += 1;
+	
+	return true;
+}
+
+static void null_shader_delete(Shader* s) {
+	if (!s)
+		return;
+	
+	if (s == sShaderNow)
+		sShaderNow = 0;
+	
+	sStats.shaders -= 1;
+	free(s);
+}
+
+static void null_shader_mat4(Shader* s, const char* name, const void* m) {
+	sStats.uniforms += 1;
+}
+
+static void null_shader_vec2(Shader* s, const char* name, float v0, float v1) {
+	sStats.uniforms += 1;
+}
+
+static void null_shader_vec3(Shader* s, const char* name, float v0, float v1, float v2) {
+	sStats.uniforms += 1;
+}
+
+static void null_shader_vec4(Shader* s, const char* name, float v0, float v1, float v2, float v3) {
+	sStats.uniforms += 1;
+}
+
+static void null_shader_int(Shader* s, const char* name, int v) {
+	sStats.uniforms += 1;
+}
+
+static void null_shader_float(Shader* s, const char* name, float v) {
+	sStats.uniforms += 1;
+}
+
+static void null_uniform_block(int binding, const void* data, uint32_t size) {
+	sStats.uniforms += 1;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void n64_backend_null_stats(N64NullStats* dst) {
+	*dst = sStats;
+}
+
+void n64_backend_null_reset(void) {
+	uint64_t textures = sStats.textures;
+	uint64_t shaders = sStats.shaders;
+	uint64_t meshes = sStats.meshes;
+	
+	/* live object counts aren't per-frame */
+	memset(&sStats, 0, sizeof(sStats));
+	sStats.textures = textures;
+	sStats.shaders = shaders;
+	sStats.meshes = meshes;
+}
+
+const N64Backend n64_backend_null = {
+	.name = "null",
+	
+	.begin = null_begin,
+	.end = null_end,
+	
+	.vertices = null_vertices,
+	.draw_triangles = null_draw_triangles,
+	.draw_outline = null_draw_outline,
+	
+	.mesh_new = null_mesh_new,
+	.mesh_draw = null_mesh_draw,
+	.mesh_delete = null_mesh_delete,
+	
+	.blend = null_state_bool,
+	.depth_test = null_state_bool,
+	.depth_mask = null_state_bool,
+	.cull = null_cull,
+	.polygon_offset = null_polygon_offset,
+	.polygon_offset_fill = null_state_bool,
+	.polygon_offset_line = null_state_bool,
+	.wireframe = null_state_bool,
+	.stencil = null_state_bool,
+	
+	.texture_new = null_texture_new,
+	.texture_delete = null_texture_delete,
+	.texture_bind = null_texture_bind,
+	.texture_filter = null_texture_filter,
+	.texture_wrap = null_texture_wrap,
+	.texture_upload = null_texture_upload,
+	
+	.shader_new = null_shader_new,
+	.shader_update = null_shader_update,
+	.shader_use = null_shader_use,
+	.shader_delete = null_shader_delete,
+	.shader_mat4 = null_shader_mat4,
+	.shader_vec2 = null_shader_vec2,
+	.shader_vec3 = null_shader_vec3,
+	.shader_vec4 = null_shader_vec4,
+	.shader_int = null_shader_int,
+	.shader_float = null_shader_float,
+	
+	.uniform_block = null_uniform_block,
+};
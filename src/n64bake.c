@@ -0,0 +1,562 @@
+/*
+ * n64bake.c <z64.me>
+ *
+ * bakes display lists that don't change between frames (room meshes)
+ * into one persistent mesh, drawn with one call per unique material
+ *
+ * baking runs the interpreter once with a backend that records the
+ * render state, textures, and shader uniforms in effect for each batch
+ * of triangles instead of drawing them; vertices are already in world
+ * space, so only the view and projection matrices are refreshed when a
+ * bake is drawn
+ *
+ * lit vertices are shaded from the light uniform block, which isn't
+ * recorded, so a bake is lit by whichever lights are current when it
+ * is drawn rather than the ones in effect when it was baked; point lights
+ * aren't culled per batch for the same reason
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <n64.h>
+#include <n64backend.h>
+
+#include "n64types.h"
+
+#define BAKE_UNIFORM_MAX 24
+
+enum BakeUniformType {
+	BAKE_MAT4,
+	BAKE_VEC2,
+	BAKE_VEC3,
+	BAKE_VEC4,
+	BAKE_INT,
+	BAKE_FLOAT
+};
+
+typedef struct {
+	const char* name;
+	int         type;
+	union {
+		float f[16];
+		int   i;
+	} v;
+} BakeUniform;
+
+/* everything a draw depends on besides its vertices */
+typedef struct {
+	Shader*     shader;
+	uint32_t    tex[2];
+	uint8_t     filter[2];
+	uint8_t     wrapS[2];
+	uint8_t     wrapT[2];
+	uint8_t     cull;
+	bool        blend;
+	bool        depthTest;
+	bool        depthMask;
+	bool        offsetFill;
+	bool        offsetLine;
+	bool        wireframe;
+	bool        stencil;
+	float       offsetFactor;
+	float       offsetUnits;
+	uint32_t    numUniforms;
+	BakeUniform uniform[BAKE_UNIFORM_MAX];
+} BakeState;
+
+typedef struct {
+	BakeState state;
+	N64Vtx*   vtx;
+	uint32_t  numVtx;
+	uint32_t  maxVtx;
+	uint32_t* idx;
+	uint32_t  numIdx;
+	uint32_t  maxIdx;
+	uint32_t  first; /* into the mesh's index buffer */
+} BakeGroup;
+
+/* uniforms persist per shader, so they are tracked per shader */
+typedef struct {
+	Shader*     shader;
+	uint32_t    num;
+	BakeUniform uniform[BAKE_UNIFORM_MAX];
+} BakeProgram;
+
+struct N64Bake {
+	uint32_t   mesh;
+	uint32_t   numGroups;
+	BakeGroup* group;
+};
+
+static struct {
+	const N64Backend* target;
+	BakeState    state;
+	int          unit;
+	N64Vtx       vtx[N64_VBUF_MAX];
+	uint32_t     numVtx;
+	BakeProgram* program;
+	uint32_t     numPrograms;
+	BakeGroup*   group;
+	uint32_t     numGroups;
+	uint32_t     barrier; /* groups before this are drawn before an ordered one */
+} sBake;
+
+static void* bake_grow(void* array, uint32_t* max, uint32_t need, size_t size) {
+	if (need <= *max)
+		return array;
+	
+	while (*max < need)
+		*max = *max ? *max * 2 : 64;
+	
+	array = realloc(array, *max * size);
+	assert(array);
+	
+	return array;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* blending or not writing depth means draw order matters */
+static bool bake_ordered(const BakeState* state) {
+	return state->blend || !state->depthTest || !state->depthMask;
+}
+
+static BakeGroup* bake_group(const BakeState* state) {
+	BakeGroup* group;
+	
+	if (bake_ordered(state)) {
+		/* can only join the batch drawn right before it */
+		if (sBake.numGroups && !memcmp(&sBake.group[sBake.numGroups - 1].state, state, sizeof(*state)))
+			return &sBake.group[sBake.numGroups - 1];
+	} else {
+		for (uint32_t i = sBake.barrier; i < sBake.numGroups; ++i) {
+			if (!memcmp(&sBake.group[i].state, state, sizeof(*state)))
+				return &sBake.group[i];
+		}
+	}
+	
+	sBake.group = realloc(sBake.group, sizeof(*sBake.group) * (sBake.numGroups + 1));
+	assert(sBake.group);
+	group = &sBake.group[sBake.numGroups++];
+	memset(group, 0, sizeof(*group));
+	memcpy(&group->state, state, sizeof(*state));
+	if (bake_ordered(state))
+		sBake.barrier = sBake.numGroups;
+	
+	return group;
+}
+
+static BakeProgram* bake_program(Shader* shader) {
+	BakeProgram* program;
+	
+	for (uint32_t i = 0; i < sBake.numPrograms; ++i) {
+		if (sBake.program[i].shader == shader)
+			return &sBake.program[i];
+	}
+	
+	sBake.program = realloc(sBake.program, sizeof(*sBake.program) * (sBake.numPrograms + 1));
+	assert(sBake.program);
+	program = &sBake.program[sBake.numPrograms++];
+	memset(program, 0, sizeof(*program));
+	program->shader = shader;
+	
+	return program;
+}
+
+static void bake_uniform(Shader* shader, const char* name, int type, const void* v, size_t size) {
+	BakeProgram* program;
+	BakeUniform* u;
+	uint32_t i;
+	
+	/* these follow the camera, so they're set when drawing instead;
+	 * the light cull mask is only good for the lights bound right now */
+	if (!shader || !strcmp(name, "view") || !strcmp(name, "projection") || !strcmp(name, "uLightCull"))
+		return;
+	
+	program = bake_program(shader);
+	for (i = 0; i < program->num; ++i) {
+		if (!strcmp(program->uniform[i].name, name))
+			break;
+	}
+	
+	if (i == program->num) {
+		assert(program->num < BAKE_UNIFORM_MAX && "too many uniforms to bake");
+		if (program->num >= BAKE_UNIFORM_MAX)
+			return;
+		program->num += 1;
+		program->uniform[i].name = name;
+	}
+	
+	u = &program->uniform[i];
+	u->type = type;
+	memset(&u->v, 0, sizeof(u->v));
+	memcpy(&u->v, v, size);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void rec_begin(void) {
+}
+
+static void rec_end(void) {
+}
+
+static void rec_vertices(const N64Vtx* vtx, uint32_t num) {
+	sBake.numVtx = num < N64_VBUF_MAX ? num : N64_VBUF_MAX;
+	memcpy(sBake.vtx, vtx, sizeof(*vtx) * sBake.numVtx);
+}
+
+static void rec_draw_triangles(const uint8_t* indices, uint32_t num) {
+	int32_t remap[N64_VBUF_MAX];
+	BakeProgram* program;
+	BakeGroup* group;
+	BakeState state;
+	
+	if (!num)
+		return;
+	
+	memcpy(&state, &sBake.state, sizeof(state));
+	program = bake_program(state.shader);
+	state.numUniforms = program->num;
+	memset(state.uniform, 0, sizeof(state.uniform));
+	memcpy(state.uniform, program->uniform, sizeof(*program->uniform) * program->num);
+	
+	group = bake_group(&state);
+	group->idx = bake_grow(group->idx, &group->maxIdx, group->numIdx + num, sizeof(*group->idx));
+	
+	/* only copy the vertices this batch uses */
+	memset(remap, -1, sizeof(remap));
+	for (uint32_t i = 0; i < num; ++i) {
+		uint8_t v = indices[i];
+		
+		assert(v < sBake.numVtx);
+		if (remap[v] < 0) {
+			group->vtx = bake_grow(group->vtx, &group->maxVtx, group->numVtx + 1, sizeof(*group->vtx));
+			group->vtx[group->numVtx] = sBake.vtx[v];
+			remap[v] = group->numVtx++;
+		}
+		
+		group->idx[group->numIdx++] = remap[v];
+	}
+}
+
+/* outlines highlight selected geometry, which isn't static */
+static void rec_draw_outline(const N64Vtx* vtx, uint32_t num) {
+}
+
+static uint32_t rec_mesh_new(const N64Vtx* vtx, uint32_t numVtx, const uint32_t* indices, uint32_t numIndices) {
+	return sBake.target->mesh_new(vtx, numVtx, indices, numIndices);
+}
+
+static void rec_mesh_draw(uint32_t mesh, uint32_t first, uint32_t num) {
+}
+
+static void rec_mesh_delete(uint32_t mesh) {
+	sBake.target->mesh_delete(mesh);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void rec_blend(bool enable) {
+	sBake.state.blend = enable;
+	sBake.target->blend(enable);
+}
+
+static void rec_depth_test(bool enable) {
+	sBake.state.depthTest = enable;
+	sBake.target->depth_test(enable);
+}
+
+static void rec_depth_mask(bool enable) {
+	sBake.state.depthMask = enable;
+	sBake.target->depth_mask(enable);
+}
+
+static void rec_cull(enum N64Cull mode) {
+	sBake.state.cull = mode;
+	sBake.target->cull(mode);
+}
+
+static void rec_polygon_offset(float factor, float units) {
+	sBake.state.offsetFactor = factor;
+	sBake.state.offsetUnits = units;
+	sBake.target->polygon_offset(factor, units);
+}
+
+static void rec_polygon_offset_fill(bool enable) {
+	sBake.state.offsetFill = enable;
+	sBake.target->polygon_offset_fill(enable);
+}
+
+static void rec_polygon_offset_line(bool enable) {
+	sBake.state.offsetLine = enable;
+	sBake.target->polygon_offset_line(enable);
+}
+
+static void rec_wireframe(bool enable) {
+	sBake.state.wireframe = enable;
+	sBake.target->wireframe(enable);
+}
+
+static void rec_stencil(bool enable) {
+	sBake.state.stencil = enable;
+	sBake.target->stencil(enable);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static uint32_t rec_texture_new(void) {
+	return sBake.target->texture_new();
+}
+
+static void rec_texture_delete(uint32_t tex) {
+	sBake.target->texture_delete(tex);
+}
+
+static void rec_texture_bind(int unit, uint32_t tex) {
+	sBake.unit = unit & 1;
+	sBake.state.tex[sBake.unit] = tex;
+	sBake.target->texture_bind(unit, tex);
+}
+
+static void rec_texture_filter(enum N64Filter filter) {
+	sBake.state.filter[sBake.unit] = filter;
+	sBake.target->texture_filter(filter);
+}
+
+static void rec_texture_wrap(enum N64Wrap s, enum N64Wrap t) {
+	sBake.state.wrapS[sBake.unit] = s;
+	sBake.state.wrapT[sBake.unit] = t;
+	sBake.target->texture_wrap(s, t);
+}
+
+static void rec_texture_upload(int width, int height, const void* rgba8888) {
+	sBake.target->texture_upload(width, height, rgba8888);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static Shader* rec_shader_new(void) {
+	return sBake.target->shader_new();
+}
+
+static void rec_shader_update(Shader* s, const char* vs, const char* fs) {
+	sBake.target->shader_update(s, vs, fs);
+}
+
+static bool rec_shader_use(Shader* s) {
+	sBake.state.shader = s;
+	
+	return sBake.target->shader_use(s);
+}
+
+static void rec_shader_delete(Shader* s) {
+	sBake.target->shader_delete(s);
+}
+
+static void rec_shader_mat4(Shader* s, const char* name, const void* m) {
+	bake_uniform(s, name, BAKE_MAT4, m, sizeof(float[16]));
+	sBake.target->shader_mat4(s, name, m);
+}
+
+static void rec_shader_vec2(Shader* s, const char* name, float v0, float v1) {
+	bake_uniform(s, name, BAKE_VEC2, (float[]) { v0, v1 }, sizeof(float[2]));
+	sBake.target->shader_vec2(s, name, v0, v1);
+}
+
+static void rec_shader_vec3(Shader* s, const char* name, float v0, float v1, float v2) {
+	bake_uniform(s, name, BAKE_VEC3, (float[]) { v0, v1, v2 }, sizeof(float[3]));
+	sBake.target->shader_vec3(s, name, v0, v1, v2);
+}
+
+static void rec_shader_vec4(Shader* s, const char* name, float v0, float v1, float v2, float v3) {
+	bake_uniform(s, name, BAKE_VEC4, (float[]) { v0, v1, v2, v3 }, sizeof(float[4]));
+	sBake.target->shader_vec4(s, name, v0, v1, v2, v3);
+}
+
+static void rec_shader_int(Shader* s, const char* name, int v) {
+	bake_uniform(s, name, BAKE_INT, &v, sizeof(v));
+	sBake.target->shader_int(s, name, v);
+}
+
+static void rec_shader_float(Shader* s, const char* name, float v) {
+	bake_uniform(s, name, BAKE_FLOAT, &v, sizeof(v));
+	sBake.target->shader_float(s, name, v);
+}
+
+/* not part of the bake; it draws with whatever is current then */
+static void rec_uniform_block(int binding, const void* data, uint32_t size) {
+	sBake.target->uniform_block(binding, data, size);
+}
+
+static const N64Backend sRecorder = {
+	.name = "bake",
+	
+	.begin = rec_begin,
+	.end = rec_end,
+	
+	.vertices = rec_vertices,
+	.draw_triangles = rec_draw_triangles,
+	.draw_outline = rec_draw_outline,
+	
+	.mesh_new = rec_mesh_new,
+	.mesh_draw = rec_mesh_draw,
+	.mesh_delete = rec_mesh_delete,
+	
+	.blend = rec_blend,
+	.depth_test = rec_depth_test,
+	.depth_mask = rec_depth_mask,
+	.cull = rec_cull,
+	.polygon_offset = rec_polygon_offset,
+	.polygon_offset_fill = rec_polygon_offset_fill,
+	.polygon_offset_line = rec_polygon_offset_line,
+	.wireframe = rec_wireframe,
+	.stencil = rec_stencil,
+	
+	.texture_new = rec_texture_new,
+	.texture_delete = rec_texture_delete,
+	.texture_bind = rec_texture_bind,
+	.texture_filter = rec_texture_filter,
+	.texture_wrap = rec_texture_wrap,
+	.texture_upload = rec_texture_upload,
+	
+	.shader_new = rec_shader_new,
+	.shader_update = rec_shader_update,
+	.shader_use = rec_shader_use,
+	.shader_delete = rec_shader_delete,
+	.shader_mat4 = rec_shader_mat4,
+	.shader_vec2 = rec_shader_vec2,
+	.shader_vec3 = rec_shader_vec3,
+	.shader_vec4 = rec_shader_vec4,
+	.shader_int = rec_shader_int,
+	.shader_float = rec_shader_float,
+	
+	.uniform_block = rec_uniform_block,
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+const N64Backend* bake_record(const N64Backend* target) {
+	memset(&sBake, 0, sizeof(sBake));
+	sBake.target = target;
+	
+	/* what n64_draw_dlist() starts from if nothing else is set */
+	sBake.state.depthTest = true;
+	sBake.state.depthMask = true;
+	sBake.state.filter[0] = sBake.state.filter[1] = N64_FILTER_LINEAR;
+	
+	return &sRecorder;
+}
+
+N64Bake* bake_finish(void) {
+	N64Bake* bake = calloc(1, sizeof(*bake));
+	uint32_t numVtx = 0;
+	uint32_t numIdx = 0;
+	N64Vtx* vtx;
+	uint32_t* idx;
+	
+	assert(bake);
+	for (uint32_t i = 0; i < sBake.numGroups; ++i) {
+		numVtx += sBake.group[i].numVtx;
+		numIdx += sBake.group[i].numIdx;
+	}
+	
+	/* every group goes into the same buffers */
+	vtx = malloc(sizeof(*vtx) * (numVtx + 1));
+	idx = malloc(sizeof(*idx) * (numIdx + 1));
+	assert(vtx && idx);
+	numVtx = numIdx = 0;
+	for (uint32_t i = 0; i < sBake.numGroups; ++i) {
+		BakeGroup* group = &sBake.group[i];
+		
+		memcpy(vtx + numVtx, group->vtx, sizeof(*vtx) * group->numVtx);
+		for (uint32_t k = 0; k < group->numIdx; ++k)
+			idx[numIdx + k] = group->idx[k] + numVtx;
+		
+		group->first = numIdx;
+		numVtx += group->numVtx;
+		numIdx += group->numIdx;
+		
+		free(group->vtx);
+		group->vtx = 0;
+		group->maxVtx = 0;
+		free(group->idx);
+		group->idx = 0;
+		group->maxIdx = 0;
+	}
+	
+	if (numIdx)
+		bake->mesh = sBake.target->mesh_new(vtx, numVtx, idx, numIdx);
+	bake->group = sBake.group;
+	bake->numGroups = sBake.numGroups;
+	
+	free(vtx);
+	free(idx);
+	free(sBake.program);
+	memset(&sBake, 0, sizeof(sBake));
+	
+	return bake;
+}
+
+void bake_draw(const N64Bake* bake, const N64Backend* backend, const Mtx* view, const Mtx* projection) {
+	if (!bake || !bake->mesh)
+		return;
+	
+	for (uint32_t i = 0; i < bake->numGroups; ++i) {
+		const BakeGroup* group = &bake->group[i];
+		const BakeState* state = &group->state;
+		Shader* s = state->shader;
+		
+		if (s) {
+			backend->shader_use(s);
+			backend->shader_mat4(s, "view", view);
+			backend->shader_mat4(s, "projection", projection);
+			backend->shader_int(s, "uLightCull", 0);
+		}
+		
+		for (uint32_t k = 0; k < state->numUniforms; ++k) {
+			const BakeUniform* u = &state->uniform[k];
+			const float* f = u->v.f;
+			
+			switch (u->type) {
+				case BAKE_MAT4: backend->shader_mat4(s, u->name, f); break;
+				case BAKE_VEC2: backend->shader_vec2(s, u->name, f[0], f[1]); break;
+				case BAKE_VEC3: backend->shader_vec3(s, u->name, f[0], f[1], f[2]); break;
+				case BAKE_VEC4: backend->shader_vec4(s, u->name, f[0], f[1], f[2], f[3]); break;
+				case BAKE_INT: backend->shader_int(s, u->name, u->v.i); break;
+				case BAKE_FLOAT: backend->shader_float(s, u->name, f[0]); break;
+			}
+		}
+		
+		for (int unit = 0; unit < 2; ++unit) {
+			backend->texture_bind(unit, state->tex[unit]);
+			if (state->tex[unit]) {
+				backend->texture_filter(state->filter[unit]);
+				backend->texture_wrap(state->wrapS[unit], state->wrapT[unit]);
+			}
+		}
+		
+		backend->blend(state->blend);
+		backend->depth_test(state->depthTest);
+		backend->depth_mask(state->depthMask);
+		backend->cull(state->cull);
+		backend->polygon_offset_fill(state->offsetFill);
+		backend->polygon_offset_line(state->offsetLine);
+		backend->polygon_offset(state->offsetFactor, state->offsetUnits);
+		backend->wireframe(state->wireframe);
+		backend->stencil(state->stencil);
+		
+		backend->mesh_draw(bake->mesh, group->first, group->numIdx);
+	}
+}
+
+void n64_bake_free(N64Bake* bake) {
+	if (!bake)
+		return;
+	
+	n64_get_backend()->mesh_delete(bake->mesh);
+	free(bake->group);
+	free(bake);
+}
@@ -0,0 +1,386 @@
+/*
+ * n64cmd.c <z64.me>
+ *
+ * command buffers for decoding display lists on other threads
+ *
+ * each decode thread records the backend calls it would have made into
+ * its own buffer, and the thread that owns the graphics context replays
+ * them in order once every thread is done; texture uploads and shader
+ * compiles go into one buffer shared by all threads instead, which is
+ * replayed first, because a texture or shader created by one thread may
+ * already be in use by a display list that is replayed before it
+ *
+ * uniform names are kept by pointer, so they must outlive the replay
+ * (n64.c only uses string literals)
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <n64.h>
+#include <n64backend.h>
+
+#include "n64types.h"
+
+enum CmdOp {
+	CMD_BEGIN,
+	CMD_END,
+	CMD_VERTICES,
+	CMD_DRAW_TRIANGLES,
+	CMD_DRAW_OUTLINE,
+	CMD_MESH_DRAW,
+	CMD_BLEND,
+	CMD_DEPTH_TEST,
+	CMD_DEPTH_MASK,
+	CMD_CULL,
+	CMD_POLYGON_OFFSET,
+	CMD_POLYGON_OFFSET_FILL,
+	CMD_POLYGON_OFFSET_LINE,
+	CMD_WIREFRAME,
+	CMD_STENCIL,
+	CMD_TEXTURE_BIND,
+	CMD_TEXTURE_FILTER,
+	CMD_TEXTURE_WRAP,
+	CMD_TEXTURE_UPLOAD,
+	CMD_SHADER_UPDATE,
+	CMD_SHADER_USE,
+	CMD_SHADER_MAT4,
+	CMD_SHADER_VEC2,
+	CMD_SHADER_VEC3,
+	CMD_SHADER_VEC4,
+	CMD_SHADER_INT,
+	CMD_SHADER_FLOAT
+};
+
+/* followed by size bytes of data, padded to 8 */
+typedef struct {
+	uint32_t    op;
+	uint32_t    size;
+	Shader*     shader;
+	const char* name;
+	union {
+		float    f[4];
+		int32_t  i[4];
+		uint32_t u[4];
+	} v;
+} Cmd;
+
+static const N64Backend* sTarget;
+static _Thread_local CmdBuf* sRec;
+static CmdBuf sShared;
+static pthread_mutex_t sSharedLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cmd_push(CmdBuf* buf, Cmd cmd, const void* data, uint32_t size) {
+	uint32_t need = buf->size + sizeof(cmd) + ((size + 7) & ~7);
+	
+	if (need > buf->max) {
+		while (buf->max < need)
+			buf->max = buf->max ? buf->max * 2 : 0x10000;
+		
+		buf->data = realloc(buf->data, buf->max);
+		assert(buf->data);
+	}
+	
+	cmd.size = size;
+	memcpy(buf->data + buf->size, &cmd, sizeof(cmd));
+	if (size)
+		memcpy(buf->data + buf->size + sizeof(cmd), data, size);
+	buf->size = need;
+}
+
+static void cmd_replay(CmdBuf* buf, const N64Backend* t) {
+	const uint8_t* b = buf->data;
+	const uint8_t* end = b + buf->size;
+	
+	while (b < end) {
+		const Cmd* cmd = (const void*)b;
+		const void* data = cmd + 1;
+		const float* f = cmd->v.f;
+		const int32_t* i = cmd->v.i;
+		
+		switch (cmd->op) {
+			case CMD_BEGIN: t->begin(); break;
+			case CMD_END: t->end(); break;
+			case CMD_VERTICES: t->vertices(data, cmd->v.u[0]); break;
+			case CMD_DRAW_TRIANGLES: t->draw_triangles(data, cmd->size); break;
+			case CMD_DRAW_OUTLINE: t->draw_outline(data, cmd->v.u[0]); break;
+			case CMD_MESH_DRAW: t->mesh_draw(cmd->v.u[0], cmd->v.u[1], cmd->v.u[2]); break;
+			case CMD_BLEND: t->blend(i[0]); break;
+			case CMD_DEPTH_TEST: t->depth_test(i[0]); break;
+			case CMD_DEPTH_MASK: t->depth_mask(i[0]); break;
+			case CMD_CULL: t->cull(i[0]); break;
+			case CMD_POLYGON_OFFSET: t->polygon_offset(f[0], f[1]); break;
+			case CMD_POLYGON_OFFSET_FILL: t->polygon_offset_fill(i[0]); break;
+			case CMD_POLYGON_OFFSET_LINE: t->polygon_offset_line(i[0]); break;
+			case CMD_WIREFRAME: t->wireframe(i[0]); break;
+			case CMD_STENCIL: t->stencil(i[0]); break;
+			case CMD_TEXTURE_BIND: t->texture_bind(i[0], cmd->v.u[1]); break;
+			case CMD_TEXTURE_FILTER: t->texture_filter(i[0]); break;
+			case CMD_TEXTURE_WRAP: t->texture_wrap(i[0], i[1]); break;
+			case CMD_TEXTURE_UPLOAD: t->texture_upload(i[0], i[1], data); break;
+			case CMD_SHADER_UPDATE: t->shader_update(cmd->shader, data, (const char*)data + cmd->v.u[0]); break;
+			case CMD_SHADER_USE: t->shader_use(cmd->shader); break;
+			case CMD_SHADER_MAT4: t->shader_mat4(cmd->shader, cmd->name, data); break;
+			case CMD_SHADER_VEC2: t->shader_vec2(cmd->shader, cmd->name, f[0], f[1]); break;
+			case CMD_SHADER_VEC3: t->shader_vec3(cmd->shader, cmd->name, f[0], f[1], f[2]); break;
+			case CMD_SHADER_VEC4: t->shader_vec4(cmd->shader, cmd->name, f[0], f[1], f[2], f[3]); break;
+			case CMD_SHADER_INT: t->shader_int(cmd->shader, cmd->name, i[0]); break;
+			case CMD_SHADER_FLOAT: t->shader_float(cmd->shader, cmd->name, f[0]); break;
+		}
+		
+		b += sizeof(*cmd) + ((cmd->size + 7) & ~7);
+	}
+	
+	buf->size = 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void rec_begin(void) {
+	cmd_push(sRec, (Cmd) { CMD_BEGIN }, 0, 0);
+}
+
+static void rec_end(void) {
+	cmd_push(sRec, (Cmd) { CMD_END }, 0, 0);
+}
+
+static void rec_vertices(const N64Vtx* vtx, uint32_t num) {
+	cmd_push(sRec, (Cmd) { CMD_VERTICES, .v.u = { num } }, vtx, sizeof(*vtx) * num);
+}
+
+static void rec_draw_triangles(const uint8_t* indices, uint32_t num) {
+	cmd_push(sRec, (Cmd) { CMD_DRAW_TRIANGLES }, indices, num);
+}
+
+static void rec_draw_outline(const N64Vtx* vtx, uint32_t num) {
+	cmd_push(sRec, (Cmd) { CMD_DRAW_OUTLINE, .v.u = { num } }, vtx, sizeof(*vtx) * num);
+}
+
+/* these hand out handles, so they can't wait for the replay; only
+ * shader_new() is called while decoding, and it doesn't touch the gpu */
+static uint32_t rec_mesh_new(const N64Vtx* vtx, uint32_t numVtx, const uint32_t* indices, uint32_t numIndices) {
+	return sTarget->mesh_new(vtx, numVtx, indices, numIndices);
+}
+
+static void rec_mesh_draw(uint32_t mesh, uint32_t first, uint32_t num) {
+	cmd_push(sRec, (Cmd) { CMD_MESH_DRAW, .v.u = { mesh, first, num } }, 0, 0);
+}
+
+static void rec_mesh_delete(uint32_t mesh) {
+	sTarget->mesh_delete(mesh);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void rec_blend(bool enable) {
+	cmd_push(sRec, (Cmd) { CMD_BLEND, .v.i = { enable } }, 0, 0);
+}
+
+static void rec_depth_test(bool enable) {
+	cmd_push(sRec, (Cmd) { CMD_DEPTH_TEST, .v.i = { enable } }, 0, 0);
+}
+
+static void rec_depth_mask(bool enable) {
+	cmd_push(sRec, (Cmd) { CMD_DEPTH_MASK, .v.i = { enable } }, 0, 0);
+}
+
+static void rec_cull(enum N64Cull mode) {
+	cmd_push(sRec, (Cmd) { CMD_CULL, .v.i = { mode } }, 0, 0);
+}
+
+static void rec_polygon_offset(float factor, float units) {
+	cmd_push(sRec, (Cmd) { CMD_POLYGON_OFFSET, .v.f = { factor, units } }, 0, 0);
+}
+
+static void rec_polygon_offset_fill(bool enable) {
+	cmd_push(sRec, (Cmd) { CMD_POLYGON_OFFSET_FILL, .v.i = { enable } }, 0, 0);
+}
+
+static void rec_polygon_offset_line(bool enable) {
+	cmd_push(sRec, (Cmd) { CMD_POLYGON_OFFSET_LINE, .v.i = { enable } }, 0, 0);
+}
+
+static void rec_wireframe(bool enable) {
+	cmd_push(sRec, (Cmd) { CMD_WIREFRAME, .v.i = { enable } }, 0, 0);
+}
+
+static void rec_stencil(bool enable) {
+	cmd_push(sRec, (Cmd) { CMD_STENCIL, .v.i = { enable } }, 0, 0);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static uint32_t rec_texture_new(void) {
+	return sTarget->texture_new();
+}
+
+static void rec_texture_delete(uint32_t tex) {
+	sTarget->texture_delete(tex);
+}
+
+static void rec_texture_bind(int unit, uint32_t tex) {
+	sRec->unit = unit & 1;
+	sRec->tex[sRec->unit] = tex;
+	cmd_push(sRec, (Cmd) { CMD_TEXTURE_BIND, .v.u = { unit, tex } }, 0, 0);
+}
+
+static void rec_texture_filter(enum N64Filter filter) {
+	cmd_push(sRec, (Cmd) { CMD_TEXTURE_FILTER, .v.i = { filter } }, 0, 0);
+}
+
+static void rec_texture_wrap(enum N64Wrap s, enum N64Wrap t) {
+	cmd_push(sRec, (Cmd) { CMD_TEXTURE_WRAP, .v.i = { s, t } }, 0, 0);
+}
+
+static void rec_texture_upload(int width, int height, const void* rgba8888) {
+	int unit = sRec->unit;
+	
+	pthread_mutex_lock(&sSharedLock);
+	cmd_push(&sShared, (Cmd) { CMD_TEXTURE_BIND, .v.u = { unit, sRec->tex[unit] } }, 0, 0);
+	cmd_push(&sShared, (Cmd) { CMD_TEXTURE_UPLOAD, .v.i = { width, height } }, rgba8888, width * height * 4);
+	pthread_mutex_unlock(&sSharedLock);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static Shader* rec_shader_new(void) {
+	return sTarget->shader_new();
+}
+
+static void rec_shader_update(Shader* s, const char* vs, const char* fs) {
+	uint32_t vsLen = strlen(vs) + 1;
+	uint32_t fsLen = strlen(fs) + 1;
+	char* src = malloc(vsLen + fsLen);
+	
+	assert(src);
+	memcpy(src, vs, vsLen);
+	memcpy(src + vsLen, fs, fsLen);
+	
+	pthread_mutex_lock(&sSharedLock);
+	cmd_push(&sShared, (Cmd) { CMD_SHADER_UPDATE, .shader = s, .v.u = { vsLen } }, src, vsLen + fsLen);
+	pthread_mutex_unlock(&sSharedLock);
+	
+	free(src);
+}
+
+/* same answer the target would give, as seen from this buffer */
+static bool rec_shader_use(Shader* s) {
+	if (s == sRec->shader)
+		return false;
+	
+	sRec->shader = s;
+	cmd_push(sRec, (Cmd) { CMD_SHADER_USE, .shader = s }, 0, 0);
+	
+	return true;
+}
+
+static void rec_shader_delete(Shader* s) {
+	sTarget->shader_delete(s);
+}
+
+static void rec_shader_mat4(Shader* s, const char* name, const void* m) {
+	cmd_push(sRec, (Cmd) { CMD_SHADER_MAT4, .shader = s, .name = name }, m, sizeof(float[16]));
+}
+
+static void rec_shader_vec2(Shader* s, const char* name, float v0, float v1) {
+	cmd_push(sRec, (Cmd) { CMD_SHADER_VEC2, .shader = s, .name = name, .v.f = { v0, v1 } }, 0, 0);
+}
+
+static void rec_shader_vec3(Shader* s, const char* name, float v0, float v1, float v2) {
+	cmd_push(sRec, (Cmd) { CMD_SHADER_VEC3, .shader = s, .name = name, .v.f = { v0, v1, v2 } }, 0, 0);
+}
+
+static void rec_shader_vec4(Shader* s, const char* name, float v0, float v1, float v2, float v3) {
+	cmd_push(sRec, (Cmd) { CMD_SHADER_VEC4, .shader = s, .name = name, .v.f = { v0, v1, v2, v3 } }, 0, 0);
+}
+
+static void rec_shader_int(Shader* s, const char* name, int v) {
+	cmd_push(sRec, (Cmd) { CMD_SHADER_INT, .shader = s, .name = name, .v.i = { v } }, 0, 0);
+}
+
+static void rec_shader_float(Shader* s, const char* name, float v) {
+	cmd_push(sRec, (Cmd) { CMD_SHADER_FLOAT, .shader = s, .name = name, .v.f = { v } }, 0, 0);
+}
+
+/* only uploaded by the flushing thread, before any decoding starts */
+static void rec_uniform_block(int binding, const void* data, uint32_t size) {
+	sTarget->uniform_block(binding, data, size);
+}
+
+static const N64Backend sRecorder = {
+	.name = "cmdbuf",
+	
+	.begin = rec_begin,
+	.end = rec_end,
+	
+	.vertices = rec_vertices,
+	.draw_triangles = rec_draw_triangles,
+	.draw_outline = rec_draw_outline,
+	
+	.mesh_new = rec_mesh_new,
+	.mesh_draw = rec_mesh_draw,
+	.mesh_delete = rec_mesh_delete,
+	
+	.blend = rec_blend,
+	.depth_test = rec_depth_test,
+	.depth_mask = rec_depth_mask,
+	.cull = rec_cull,
+	.polygon_offset = rec_polygon_offset,
+	.polygon_offset_fill = rec_polygon_offset_fill,
+	.polygon_offset_line = rec_polygon_offset_line,
+	.wireframe = rec_wireframe,
+	.stencil = rec_stencil,
+	
+	.texture_new = rec_texture_new,
+	.texture_delete = rec_texture_delete,
+	.texture_bind = rec_texture_bind,
+	.texture_filter = rec_texture_filter,
+	.texture_wrap = rec_texture_wrap,
+	.texture_upload = rec_texture_upload,
+	
+	.shader_new = rec_shader_new,
+	.shader_update = rec_shader_update,
+	.shader_use = rec_shader_use,
+	.shader_delete = rec_shader_delete,
+	.shader_mat4 = rec_shader_mat4,
+	.shader_vec2 = rec_shader_vec2,
+	.shader_vec3 = rec_shader_vec3,
+	.shader_vec4 = rec_shader_vec4,
+	.shader_int = rec_shader_int,
+	.shader_float = rec_shader_float,
+	
+	.uniform_block = rec_uniform_block,
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* call before starting the decode threads */
+const N64Backend* cmdbuf_begin(const N64Backend* target) {
+	sTarget = target;
+	
+	return &sRecorder;
+}
+
+/* call on each decode thread before it uses the recorder */
+void cmdbuf_record(CmdBuf* buf) {
+	buf->size = 0;
+	buf->tex[0] = buf->tex[1] = 0;
+	buf->unit = 0;
+	buf->shader = 0;
+	sRec = buf;
+}
+
+/* call after joining the decode threads, on the graphics thread; target
+ * may be another recorder wrapping the one given to cmdbuf_begin() */
+void cmdbuf_end(CmdBuf* buf, uint32_t num, const N64Backend* target) {
+	cmd_replay(&sShared, target);
+	for (uint32_t i = 0; i < num; ++i)
+		cmd_replay(&buf[i], target);
+}
+
+void cmdbuf_free(CmdBuf* buf) {
+	free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+}
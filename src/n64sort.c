@@ -0,0 +1,661 @@
+/*
+ * n64sort.c <z64.me>
+ *
+ * draws a layer sorted by material instead of in display list order,
+ * so the backend switches shaders and textures as rarely as it can
+ *
+ * the interpreter draws into a backend that records the render state,
+ * textures, shader uniforms, and vertices of each batch of triangles,
+ * like n64bake.c does; sort_end() then submits the batches grouped by
+ * shader, then textures, then render state, nearest first in a group
+ *
+ * batches whose order matters keep their place and split the layer into
+ * runs that are sorted on their own, so nothing crosses them; decals
+ * (polygon offset) are submitted after the rest of their run, so they
+ * still land on what they decorate
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <n64.h>
+#include <n64backend.h>
+
+#include "n64types.h"
+
+#define SORT_UNIFORM_MAX 24
+
+enum SortUniformType {
+	SORT_MAT4,
+	SORT_VEC2,
+	SORT_VEC3,
+	SORT_VEC4,
+	SORT_INT,
+	SORT_FLOAT
+};
+
+typedef struct {
+	const char* name;
+	int         type;
+	union {
+		float f[16];
+		int   i;
+	} v;
+} SortUniform;
+
+/* everything a draw depends on besides its vertices and uniforms */
+typedef struct {
+	Shader*  shader;
+	uint32_t tex[2];
+	uint8_t  filter[2];
+	uint8_t  wrapS[2];
+	uint8_t  wrapT[2];
+	uint8_t  cull;
+	bool     blend;
+	bool     depthTest;
+	bool     depthMask;
+	bool     offsetFill;
+	bool     offsetLine;
+	bool     wireframe;
+	bool     stencil;
+	float    offsetFactor;
+	float    offsetUnits;
+} SortState;
+
+/* uniforms persist per shader, so they are tracked per shader */
+typedef struct {
+	Shader*     shader;
+	uint32_t    num;
+	SortUniform uniform[SORT_UNIFORM_MAX];
+	uint32_t    snapshot; /* copy of uniform[] in sSort.uniform, ~0 if stale */
+	uint32_t    applied;  /* snapshot the target was last given */
+} SortProgram;
+
+typedef struct {
+	SortState state;
+	uint32_t  program;
+	uint32_t  uniform;
+	uint32_t  numUniforms;
+	uint32_t  vtx;
+	uint32_t  numVtx;
+	uint32_t  idx;
+	uint32_t  numIdx;
+	uint32_t  mesh; /* 0 for streamed vertices */
+	uint32_t  first;
+	uint32_t  depth;
+} SortDraw;
+
+typedef struct {
+	uint32_t run;   /* ordered batches submitted before this one */
+	uint32_t layer; /* decal, then program; ordered batches end a run */
+	uint32_t state;
+	uint64_t tex;
+	uint32_t depth;
+	uint32_t draw;  /* submission order breaks ties */
+} SortKey;
+
+static struct {
+	const N64Backend* target;
+	SortState    state;
+	int          unit;
+	Mtx          view;
+	N64Vtx       vbuf[N64_VBUF_MAX];
+	uint32_t     numVbuf;
+	SortProgram* program;
+	uint32_t     numPrograms;
+	uint32_t     maxPrograms;
+	uint32_t     lastProgram;
+	SortDraw*    draw;
+	uint32_t     numDraws;
+	uint32_t     maxDraws;
+	SortKey*     key;
+	uint32_t     maxKeys;
+	SortUniform* uniform;
+	uint32_t     numUniforms;
+	uint32_t     maxUniforms;
+	N64Vtx*      vtx;
+	uint32_t     numVtx;
+	uint32_t     maxVtx;
+	uint8_t*     idx;
+	uint32_t     numIdx;
+	uint32_t     maxIdx;
+	SortState    current; /* what the target has, once known */
+	bool         known;
+} sSort;
+
+static void* sort_grow(void* array, uint32_t* max, uint32_t need, size_t size) {
+	if (need <= *max)
+		return array;
+	
+	while (*max < need)
+		*max = *max ? *max * 2 : 64;
+	
+	array = realloc(array, *max * size);
+	assert(array);
+	
+	return array;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* blending or not writing depth means draw order matters */
+static bool sort_ordered(const SortState* state) {
+	return state->blend || !state->depthTest || !state->depthMask;
+}
+
+static uint32_t sort_program(Shader* shader) {
+	SortProgram* program;
+	
+	if (sSort.lastProgram < sSort.numPrograms && sSort.program[sSort.lastProgram].shader == shader)
+		return sSort.lastProgram;
+	
+	for (uint32_t i = 0; i < sSort.numPrograms; ++i) {
+		if (sSort.program[i].shader == shader)
+			return sSort.lastProgram = i;
+	}
+	
+	sSort.program = sort_grow(sSort.program, &sSort.maxPrograms, sSort.numPrograms + 1, sizeof(*sSort.program));
+	program = &sSort.program[sSort.numPrograms];
+	program->shader = shader;
+	program->num = 0;
+	program->snapshot = ~0u;
+	
+	return sSort.lastProgram = sSort.numPrograms++;
+}
+
+static void sort_uniform(Shader* shader, const char* name, int type, const void* v, size_t size) {
+	SortProgram* program;
+	SortUniform* u;
+	uint32_t i;
+	
+	if (!shader)
+		return;
+	
+	/* for the depth part of the sort key */
+	if (type == SORT_MAT4 && !strcmp(name, "view"))
+		memcpy(&sSort.view, v, sizeof(sSort.view));
+	
+	i = sort_program(shader);
+	program = &sSort.program[i];
+	for (i = 0; i < program->num; ++i) {
+		if (!strcmp(program->uniform[i].name, name))
+			break;
+	}
+	
+	if (i == program->num) {
+		assert(program->num < SORT_UNIFORM_MAX && "too many uniforms to sort");
+		if (program->num >= SORT_UNIFORM_MAX)
+			return;
+		program->num += 1;
+		program->uniform[i].name = name;
+	} else if (program->uniform[i].type == type && !memcmp(&program->uniform[i].v, v, size)) {
+		return;
+	}
+	
+	u = &program->uniform[i];
+	u->type = type;
+	memset(&u->v, 0, sizeof(u->v));
+	memcpy(&u->v, v, size);
+	program->snapshot = ~0u;
+}
+
+/* nonnegative floats order like their bits do */
+static uint32_t sort_depth(float dist) {
+	uint32_t bits;
+	
+	if (!(dist > 0))
+		return 0;
+	memcpy(&bits, &dist, sizeof(bits));
+	
+	return bits;
+}
+
+/* draws share a copy of the uniforms until one of them changes */
+static void sort_snapshot(SortProgram* program) {
+	if (program->snapshot != ~0u)
+		return;
+	
+	sSort.uniform = sort_grow(sSort.uniform, &sSort.maxUniforms, sSort.numUniforms + program->num, sizeof(*sSort.uniform));
+	memcpy(sSort.uniform + sSort.numUniforms, program->uniform, sizeof(*program->uniform) * program->num);
+	program->snapshot = sSort.numUniforms;
+	sSort.numUniforms += program->num;
+}
+
+static SortDraw* sort_draw(void) {
+	SortProgram* program;
+	SortDraw* draw;
+	
+	sSort.draw = sort_grow(sSort.draw, &sSort.maxDraws, sSort.numDraws + 1, sizeof(*sSort.draw));
+	draw = &sSort.draw[sSort.numDraws++];
+	memset(draw, 0, sizeof(*draw));
+	draw->state = sSort.state;
+	draw->program = sort_program(sSort.state.shader);
+	
+	program = &sSort.program[draw->program];
+	sort_snapshot(program);
+	draw->uniform = program->snapshot;
+	draw->numUniforms = program->num;
+	
+	return draw;
+}
+
+/* the program has to be in use */
+static void sort_apply_uniforms(SortProgram* program, uint32_t snapshot, uint32_t num) {
+	const N64Backend* t = sSort.target;
+	Shader* s = program->shader;
+	
+	if (program->applied == snapshot)
+		return;
+	
+	program->applied = snapshot;
+	for (uint32_t k = 0; k < num; ++k) {
+		const SortUniform* u = &sSort.uniform[snapshot + k];
+		const float* f = u->v.f;
+		
+		switch (u->type) {
+			case SORT_MAT4: t->shader_mat4(s, u->name, f); break;
+			case SORT_VEC2: t->shader_vec2(s, u->name, f[0], f[1]); break;
+			case SORT_VEC3: t->shader_vec3(s, u->name, f[0], f[1], f[2]); break;
+			case SORT_VEC4: t->shader_vec4(s, u->name, f[0], f[1], f[2], f[3]); break;
+			case SORT_INT: t->shader_int(s, u->name, u->v.i); break;
+			case SORT_FLOAT: t->shader_float(s, u->name, f[0]); break;
+		}
+	}
+}
+
+static void sort_apply(const SortState* state) {
+	const N64Backend* t = sSort.target;
+	SortState* now = &sSort.current;
+	
+	t->shader_use(state->shader);
+	for (int unit = 0; unit < 2; ++unit) {
+		t->texture_bind(unit, state->tex[unit]);
+		if (state->tex[unit]) {
+			t->texture_filter(state->filter[unit]);
+			t->texture_wrap(state->wrapS[unit], state->wrapT[unit]);
+		}
+	}
+	
+	/* the target caches binds, but not render state */
+	if (!sSort.known || now->blend != state->blend)
+		t->blend(state->blend);
+	if (!sSort.known || now->depthTest != state->depthTest)
+		t->depth_test(state->depthTest);
+	if (!sSort.known || now->depthMask != state->depthMask)
+		t->depth_mask(state->depthMask);
+	if (!sSort.known || now->cull != state->cull)
+		t->cull(state->cull);
+	if (!sSort.known || now->offsetFill != state->offsetFill)
+		t->polygon_offset_fill(state->offsetFill);
+	if (!sSort.known || now->offsetLine != state->offsetLine)
+		t->polygon_offset_line(state->offsetLine);
+	if (!sSort.known || now->offsetFactor != state->offsetFactor || now->offsetUnits != state->offsetUnits)
+		t->polygon_offset(state->offsetFactor, state->offsetUnits);
+	if (!sSort.known || now->wireframe != state->wireframe)
+		t->wireframe(state->wireframe);
+	if (!sSort.known || now->stencil != state->stencil)
+		t->stencil(state->stencil);
+	
+	*now = *state;
+	sSort.known = true;
+}
+
+static void sort_submit(const SortDraw* draw) {
+	const N64Backend* t = sSort.target;
+	
+	sort_apply(&draw->state);
+	sort_apply_uniforms(&sSort.program[draw->program], draw->uniform, draw->numUniforms);
+	
+	if (draw->mesh) {
+		t->mesh_draw(draw->mesh, draw->first, draw->numIdx);
+		return;
+	}
+	
+	t->vertices(sSort.vtx + draw->vtx, draw->numVtx);
+	t->draw_triangles(sSort.idx + draw->idx, draw->numIdx);
+}
+
+static int sort_cmp(const void* a, const void* b) {
+	const SortKey* x = a;
+	const SortKey* y = b;
+	
+	if (x->run != y->run)
+		return x->run < y->run ? -1 : 1;
+	if (x->layer != y->layer)
+		return x->layer < y->layer ? -1 : 1;
+	if (x->tex != y->tex)
+		return x->tex < y->tex ? -1 : 1;
+	if (x->state != y->state)
+		return x->state < y->state ? -1 : 1;
+	if (x->depth != y->depth)
+		return x->depth < y->depth ? -1 : 1;
+	
+	return x->draw < y->draw ? -1 : x->draw > y->draw;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void rec_begin(void) {
+}
+
+static void rec_end(void) {
+}
+
+static void rec_vertices(const N64Vtx* vtx, uint32_t num) {
+	sSort.numVbuf = num < N64_VBUF_MAX ? num : N64_VBUF_MAX;
+	memcpy(sSort.vbuf, vtx, sizeof(*vtx) * sSort.numVbuf);
+}
+
+static void rec_draw_triangles(const uint8_t* indices, uint32_t num) {
+	int32_t remap[N64_VBUF_MAX];
+	const Mtx* view = &sSort.view;
+	float nearest = -1e30f;
+	SortDraw* draw;
+	
+	if (!num || !sSort.numVbuf)
+		return;
+	
+	draw = sort_draw();
+	draw->vtx = sSort.numVtx;
+	draw->idx = sSort.numIdx;
+	draw->numIdx = num;
+	sSort.idx = sort_grow(sSort.idx, &sSort.maxIdx, sSort.numIdx + num, sizeof(*sSort.idx));
+	
+	/* only copy the vertices this batch uses */
+	memset(remap, -1, sizeof(remap));
+	for (uint32_t i = 0; i < num; ++i) {
+		uint8_t v = indices[i] < sSort.numVbuf ? indices[i] : sSort.numVbuf - 1;
+		
+		if (remap[v] < 0) {
+			const N64Vector4* p = &sSort.vbuf[v].pos;
+			float z = view->zx * p->x + view->zy * p->y + view->zz * p->z + view->zw;
+			
+			if (z > nearest)
+				nearest = z;
+			sSort.vtx = sort_grow(sSort.vtx, &sSort.maxVtx, sSort.numVtx + 1, sizeof(*sSort.vtx));
+			sSort.vtx[sSort.numVtx] = sSort.vbuf[v];
+			remap[v] = sSort.numVtx++ - draw->vtx;
+		}
+		
+		sSort.idx[sSort.numIdx++] = remap[v];
+	}
+	
+	/* the camera looks down -z */
+	draw->numVtx = sSort.numVtx - draw->vtx;
+	draw->depth = sort_depth(-nearest);
+}
+
+/* the outline pass comes after the flush, so this doesn't happen */
+static void rec_draw_outline(const N64Vtx* vtx, uint32_t num) {
+	sSort.target->draw_outline(vtx, num);
+}
+
+static uint32_t rec_mesh_new(const N64Vtx* vtx, uint32_t numVtx, const uint32_t* indices, uint32_t numIndices) {
+	return sSort.target->mesh_new(vtx, numVtx, indices, numIndices);
+}
+
+static void rec_mesh_draw(uint32_t mesh, uint32_t first, uint32_t num) {
+	SortDraw* draw = sort_draw();
+	
+	draw->mesh = mesh;
+	draw->first = first;
+	draw->numIdx = num;
+}
+
+static void rec_mesh_delete(uint32_t mesh) {
+	sSort.target->mesh_delete(mesh);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void rec_blend(bool enable) {
+	sSort.state.blend = enable;
+}
+
+static void rec_depth_test(bool enable) {
+	sSort.state.depthTest = enable;
+}
+
+static void rec_depth_mask(bool enable) {
+	sSort.state.depthMask = enable;
+}
+
+static void rec_cull(enum N64Cull mode) {
+	sSort.state.cull = mode;
+}
+
+static void rec_polygon_offset(float factor, float units) {
+	sSort.state.offsetFactor = factor;
+	sSort.state.offsetUnits = units;
+}
+
+static void rec_polygon_offset_fill(bool enable) {
+	sSort.state.offsetFill = enable;
+}
+
+static void rec_polygon_offset_line(bool enable) {
+	sSort.state.offsetLine = enable;
+}
+
+static void rec_wireframe(bool enable) {
+	sSort.state.wireframe = enable;
+}
+
+static void rec_stencil(bool enable) {
+	sSort.state.stencil = enable;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static uint32_t rec_texture_new(void) {
+	return sSort.target->texture_new();
+}
+
+static void rec_texture_delete(uint32_t tex) {
+	sSort.target->texture_delete(tex);
+}
+
+static void rec_texture_bind(int unit, uint32_t tex) {
+	sSort.unit = unit & 1;
+	sSort.state.tex[sSort.unit] = tex;
+}
+
+static void rec_texture_filter(enum N64Filter filter) {
+	sSort.state.filter[sSort.unit] = filter;
+}
+
+static void rec_texture_wrap(enum N64Wrap s, enum N64Wrap t) {
+	sSort.state.wrapS[sSort.unit] = s;
+	sSort.state.wrapT[sSort.unit] = t;
+}
+
+/* uploads can't wait; every draw binds its textures again anyway */
+static void rec_texture_upload(int width, int height, const void* rgba8888) {
+	sSort.target->texture_bind(sSort.unit, sSort.state.tex[sSort.unit]);
+	sSort.target->texture_upload(width, height, rgba8888);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static Shader* rec_shader_new(void) {
+	return sSort.target->shader_new();
+}
+
+static void rec_shader_update(Shader* s, const char* vs, const char* fs) {
+	sSort.target->shader_update(s, vs, fs);
+}
+
+/* as seen from the draws recorded so far */
+static bool rec_shader_use(Shader* s) {
+	if (s == sSort.state.shader)
+		return false;
+	
+	sSort.state.shader = s;
+	
+	return true;
+}
+
+static void rec_shader_delete(Shader* s) {
+	sSort.target->shader_delete(s);
+}
+
+static void rec_shader_mat4(Shader* s, const char* name, const void* m) {
+	sort_uniform(s, name, SORT_MAT4, m, sizeof(float[16]));
+}
+
+static void rec_shader_vec2(Shader* s, const char* name, float v0, float v1) {
+	sort_uniform(s, name, SORT_VEC2, (float[]) { v0, v1 }, sizeof(float[2]));
+}
+
+static void rec_shader_vec3(Shader* s, const char* name, float v0, float v1, float v2) {
+	sort_uniform(s, name, SORT_VEC3, (float[]) { v0, v1, v2 }, sizeof(float[3]));
+}
+
+static void rec_shader_vec4(Shader* s, const char* name, float v0, float v1, float v2, float v3) {
+	sort_uniform(s, name, SORT_VEC4, (float[]) { v0, v1, v2, v3 }, sizeof(float[4]));
+}
+
+static void rec_shader_int(Shader* s, const char* name, int v) {
+	sort_uniform(s, name, SORT_INT, &v, sizeof(v));
+}
+
+static void rec_shader_float(Shader* s, const char* name, float v) {
+	sort_uniform(s, name, SORT_FLOAT, &v, sizeof(v));
+}
+
+/* shared by every draw of the layer; n64.c uploads it before drawing */
+static void rec_uniform_block(int binding, const void* data, uint32_t size) {
+	sSort.target->uniform_block(binding, data, size);
+}
+
+static const N64Backend sRecorder = {
+	.name = "sort",
+	
+	.begin = rec_begin,
+	.end = rec_end,
+	
+	.vertices = rec_vertices,
+	.draw_triangles = rec_draw_triangles,
+	.draw_outline = rec_draw_outline,
+	
+	.mesh_new = rec_mesh_new,
+	.mesh_draw = rec_mesh_draw,
+	.mesh_delete = rec_mesh_delete,
+	
+	.blend = rec_blend,
+	.depth_test = rec_depth_test,
+	.depth_mask = rec_depth_mask,
+	.cull = rec_cull,
+	.polygon_offset = rec_polygon_offset,
+	.polygon_offset_fill = rec_polygon_offset_fill,
+	.polygon_offset_line = rec_polygon_offset_line,
+	.wireframe = rec_wireframe,
+	.stencil = rec_stencil,
+	
+	.texture_new = rec_texture_new,
+	.texture_delete = rec_texture_delete,
+	.texture_bind = rec_texture_bind,
+	.texture_filter = rec_texture_filter,
+	.texture_wrap = rec_texture_wrap,
+	.texture_upload = rec_texture_upload,
+	
+	.shader_new = rec_shader_new,
+	.shader_update = rec_shader_update,
+	.shader_use = rec_shader_use,
+	.shader_delete = rec_shader_delete,
+	.shader_mat4 = rec_shader_mat4,
+	.shader_vec2 = rec_shader_vec2,
+	.shader_vec3 = rec_shader_vec3,
+	.shader_vec4 = rec_shader_vec4,
+	.shader_int = rec_shader_int,
+	.shader_float = rec_shader_float,
+	
+	.uniform_block = rec_uniform_block,
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* the buffers are kept between frames, only emptied */
+const N64Backend* sort_begin(const N64Backend* target) {
+	sSort.target = target;
+	sSort.numVbuf = 0;
+	sSort.numPrograms = 0;
+	sSort.numDraws = 0;
+	sSort.numUniforms = 0;
+	sSort.numVtx = 0;
+	sSort.numIdx = 0;
+	sSort.unit = 0;
+	
+	/* what n64_draw_dlist() starts from if nothing else is set */
+	memset(&sSort.state, 0, sizeof(sSort.state));
+	sSort.state.depthTest = true;
+	sSort.state.depthMask = true;
+	sSort.state.filter[0] = sSort.state.filter[1] = N64_FILTER_LINEAR;
+	
+	return &sRecorder;
+}
+
+void sort_end(void) {
+	const N64Backend* t = sSort.target;
+	uint32_t run = 0;
+	
+	if (!sSort.numDraws)
+		return;
+	
+	sSort.key = sort_grow(sSort.key, &sSort.maxKeys, sSort.numDraws, sizeof(*sSort.key));
+	for (uint32_t i = 0; i < sSort.numDraws; ++i) {
+		const SortDraw* draw = &sSort.draw[i];
+		const SortState* state = &draw->state;
+		SortKey* key = &sSort.key[i];
+		
+		memset(key, 0, sizeof(*key));
+		key->draw = i;
+		key->run = run;
+		if (sort_ordered(state)) {
+			key->layer = ~0u;
+			run += 1;
+			continue;
+		}
+		
+		key->layer = (uint32_t)state->offsetFill << 31 | draw->program;
+		key->tex = (uint64_t)state->tex[0] << 32 | state->tex[1];
+		key->state = state->cull
+			| state->depthTest << 2
+			| state->depthMask << 3
+			| state->offsetLine << 4
+			| state->wireframe << 5
+			| state->stencil << 6
+			| state->filter[0] << 7
+			| state->filter[1] << 8
+			| state->wrapS[0] << 9
+			| state->wrapT[0] << 11
+			| state->wrapS[1] << 13
+			| state->wrapT[1] << 15;
+		key->depth = draw->depth;
+	}
+	qsort(sSort.key, sSort.numDraws, sizeof(*sSort.key), sort_cmp);
+	
+	for (uint32_t i = 0; i < sSort.numPrograms; ++i)
+		sSort.program[i].applied = ~0u;
+	
+	t->begin();
+	sSort.known = false;
+	for (uint32_t i = 0; i < sSort.numDraws; ++i)
+		sort_submit(&sSort.draw[sSort.key[i].draw]);
+	t->end();
+	
+	/* leave the target as drawing in order would have */
+	for (uint32_t i = 0; i < sSort.numPrograms; ++i) {
+		SortProgram* program = &sSort.program[i];
+		
+		sort_snapshot(program);
+		if (program->shader && program->applied != program->snapshot) {
+			t->shader_use(program->shader);
+			sort_apply_uniforms(program, program->snapshot, program->num);
+		}
+	}
+	sort_apply(&sSort.state);
+	
+	sSort.numDraws = 0;
+}
@@ -12,7 +12,18 @@
 
 extern bool n64_tick_20fps;
 
-typedef bool (*GbiFunc)(void*);
+typedef struct GbiCmd GbiCmd;
+typedef bool (*GbiFunc)(const GbiCmd*);
+
+/* native-endian decoded display list command */
+typedef struct GbiCmd {
+	GbiFunc  func;
+	uint32_t w0;
+	uint32_t w1;
+	void*    ptr; /* w1 pre-resolved against the segment table, or 0 */
+} GbiCmd;
+
+#define GBICMD_OP(CMD) ((CMD)->w0 >> 24)
 
 typedef struct {
 	uint8_t r, g, b, a;
@@ -28,6 +39,35 @@ typedef struct ShaderList {
 	uint64_t uuid;
 } ShaderList;
 
+typedef struct DlCache {
+	struct DlCache* next;
+	const void*     dlist;
+	uint32_t        segHash;
+	uint32_t        num; /* 0 = not cacheable, interpret directly */
+	GbiCmd          cmd[];
+} DlCache;
+
+typedef struct {
+	const void* data; /* 0 = empty slot */
+	uint32_t    palHash; /* color indexed only */
+	uint16_t    width;
+	uint16_t    height;
+	uint16_t    lineSize;
+	uint8_t     fmt;
+	uint8_t     siz;
+} TexelKey;
+
+typedef struct TexelDict {
+	TexelKey key;
+	uint32_t hash;
+	uint32_t tex;
+} TexelDict;
+
+typedef struct TexelShare {
+	uint64_t hash; /* 0 = empty slot */
+	uint32_t tex;
+} TexelShare;
+
 typedef union {
 	float mf[4][4];
 	struct {
@@ -38,6 +78,28 @@ typedef union {
 	};
 } Mtx;
 
+/* everything gbiFunc_vtx's output depends on besides the source vertices */
+typedef struct {
+	Mtx      model;
+	uint32_t flags; /* vertex colors, outline, texgen */
+} VtxKey;
+
+typedef struct VtxCache {
+	struct VtxCache* next;
+	const void*      src;
+	uint32_t         num;
+	uint32_t         hash;
+	VtxKey           key;
+	N64Vtx           vtx[];
+} VtxCache;
+
+/* outlined triangles, waiting for the outline pass */
+typedef struct {
+	N64Vtx*  vtx;
+	uint32_t num;
+	uint32_t max;
+} OutlineList;
+
 typedef union {
 	int32_t m[4][4];
 	struct {
@@ -53,6 +115,65 @@ typedef struct {
 	float w;
 } N64Quat;
 
+/* memory read while capturing a trace, keyed by its original address */
+typedef struct {
+	uint64_t addr;
+	uint32_t size;
+	uint32_t offset; /* into N64Trace.data */
+} TraceRange;
+
+/* everything n64_draw_dlist() depends on that isn't display list memory */
+typedef struct {
+	uint64_t   dlist;
+	uint64_t   segment[N64_SEGMENT_MAX];
+	Mtx        view;
+	Mtx        normal;
+	Mtx        projection;
+	Mtx        modelStack[N64_MTX_STACK_SIZE];
+	uint32_t   modelNow;
+	float      fog[2];
+	float      fogColor[3];
+	GbiLightsN lights;
+	int32_t    lightNum;
+	int32_t    zmode;
+	int32_t    geoLayer;
+	int32_t    culling;
+} TraceDraw;
+
+struct N64Trace {
+	uint32_t    numDraws;
+	uint32_t    numRanges;
+	uint32_t    dataSize;
+	TraceDraw*  draw;
+	TraceRange* range;
+	uint8_t*    data;
+};
+
+/* n64bake.c */
+const struct N64Backend* bake_record(const struct N64Backend* target);
+N64Bake* bake_finish(void);
+void bake_draw(const N64Bake* bake, const struct N64Backend* backend, const Mtx* view, const Mtx* projection);
+
+/* backend calls recorded by a decode thread, see n64cmd.c */
+typedef struct {
+	uint8_t* data;
+	uint32_t size;
+	uint32_t max;
+	uint32_t tex[2]; /* bound to each unit, for texture uploads */
+	int      unit;
+	Shader*  shader; /* in use, so shader_use() can answer like the target */
+} CmdBuf;
+
+/* n64cmd.c */
+const struct N64Backend* cmdbuf_begin(const struct N64Backend* target);
+void cmdbuf_record(CmdBuf* buf);
+void cmdbuf_end(CmdBuf* buf, uint32_t num, const struct N64Backend* target);
+void cmdbuf_free(CmdBuf* buf);
+
+/* n64sort.c */
+const struct N64Backend* sort_begin(const struct N64Backend* target);
+void sort_end(void);
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-function"
 
@@ -0,0 +1,217 @@
+/*
+ * z64dlstat.c <z64.me>
+ *
+ * runs display lists through the interpreter with the null backend and
+ * reports what they would cost to draw, one line per file, so a batch
+ * of object files can be scanned for outliers without opening a window
+ *
+ * usage: z64dlstat [-s seg] [-l seg=file]... [-v] file[@offset[,offset...]]...
+ *
+ *   -s seg       segment each file is loaded to (default 6)
+ *   -l seg=file  load another segment the display lists depend on
+ *   -v           also print an opcode histogram for each file
+ *
+ * without offsets, the file is treated as one display list at offset 0
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <n64.h>
+#include <n64backend.h>
+
+#define OFFSET_MAX 256
+
+static const float sIdentity[16] = {
+	1, 0, 0, 0,
+	0, 1, 0, 0,
+	0, 0, 1, 0,
+	0, 0, 0, 1,
+};
+
+/* followed by a G_ENDDL, so a list that runs off the end still stops */
+static uint8_t* file_load(const char* filename, size_t* size) {
+	static const uint8_t endDl[8] = { G_ENDDL };
+	uint8_t* data;
+	FILE* fp;
+	long sz;
+	
+	if (!(fp = fopen(filename, "rb")))
+		return 0;
+	
+	fseek(fp, 0, SEEK_END);
+	sz = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	
+	if (sz < 0 || !(data = malloc(sz + sizeof(endDl)))) {
+		fclose(fp);
+		return 0;
+	}
+	
+	if (fread(data, 1, sz, fp) != (size_t)sz) {
+		fclose(fp);
+		free(data);
+		return 0;
+	}
+	fclose(fp);
+	
+	memcpy(data + sz, endDl, sizeof(endDl));
+	*size = sz;
+	
+	return data;
+}
+
+static int parse_offsets(char* list, uint32_t* offset) {
+	int num = 0;
+	
+	for (char* tok = strtok(list, ","); tok && num < OFFSET_MAX; tok = strtok(0, ","))
+		offset[num++] = strtoul(tok, 0, 0) & 0xffffff;
+	
+	return num;
+}
+
+static void print_histogram(const N64Stats* stats) {
+	for (int op = 0; op < 256; ++op) {
+		if (!stats->op[op].count)
+			continue;
+		
+		printf("\t%-20s %10llu\n", n64_stats_opname(op), (unsigned long long)stats->op[op].count);
+	}
+}
+
+static int dlstat(char* arg, int seg, bool verbose) {
+	uint32_t offset[OFFSET_MAX];
+	char* at = strrchr(arg, '@');
+	N64NullStats null;
+	N64Stats stats;
+	uint64_t cmds = 0;
+	uint8_t* data;
+	size_t size;
+	int num = 1;
+	
+	offset[0] = 0;
+	if (at) {
+		*at = '\0';
+		num = parse_offsets(at + 1, offset);
+	}
+	
+	if (!(data = file_load(arg, &size))) {
+		fprintf(stderr, "z64dlstat: could not read '%s'\n", arg);
+		
+		return EXIT_FAILURE;
+	}
+	
+	/* textures and shaders are counted as they are first created */
+	n64_clear_cache();
+	n64_backend_null_reset();
+	n64_stats_reset();
+	
+	n64_segment_set_sized(seg, data, size + 8); /* and the G_ENDDL */
+	for (int i = 0; i < num; ++i) {
+		if (offset[i] >= size) {
+			fprintf(stderr, "z64dlstat: '%s' has no offset 0x%06X\n", arg, offset[i]);
+			continue;
+		}
+		
+		n64_mtx_model((void*)sIdentity);
+		n64_draw_dlist(data + offset[i]);
+	}
+	n64_segment_set(seg, 0);
+	
+	n64_stats_get(&stats);
+	n64_backend_null_stats(&null);
+	for (int op = 0; op < 256; ++op)
+		cmds += stats.op[op].count;
+	
+	printf(
+		"%-32s %8llu %6llu %5u %5u %6llu %8llu %8llu %5llu %5u %5u %5llu\n",
+		arg,
+		(unsigned long long)cmds,
+		(unsigned long long)stats.dlists,
+		stats.maxDepth,
+		stats.maxMtxDepth,
+		(unsigned long long)stats.op[G_VTX].count,
+		(unsigned long long)stats.vertices,
+		(unsigned long long)null.triangles,
+		(unsigned long long)null.textureUploads,
+		stats.texturesShared,
+		stats.palettes,
+		(unsigned long long)null.shaderCompiles
+	);
+	
+	if (verbose)
+		print_histogram(&stats);
+	
+	free(data);
+	
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+	uint8_t* segment[N64_SEGMENT_MAX] = { 0 };
+	struct timespec start, end;
+	bool verbose = false;
+	int seg = 6;
+	int files = 0;
+	int rc = EXIT_SUCCESS;
+	int i;
+	
+	for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+		if (!strcmp(argv[i], "-v"))
+			verbose = true;
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			seg = strtol(argv[++i], 0, 0) & (N64_SEGMENT_MAX - 1);
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc && strchr(argv[i + 1], '=')) {
+			char* eq = strchr(argv[++i], '=');
+			int n = strtol(argv[i], 0, 0) & (N64_SEGMENT_MAX - 1);
+			size_t size;
+			
+			if (!(segment[n] = file_load(eq + 1, &size))) {
+				fprintf(stderr, "z64dlstat: could not read '%s'\n", eq + 1);
+				
+				return EXIT_FAILURE;
+			}
+		} else
+			break;
+	}
+	
+	if (i >= argc) {
+		fprintf(stderr, "usage: z64dlstat [-s seg] [-l seg=file]... [-v] file[@offset[,offset...]]...\n");
+		
+		return EXIT_FAILURE;
+	}
+	
+	n64_set_backend(&n64_backend_null);
+	n64_buffer_init();
+	n64_mtx_view((void*)sIdentity);
+	n64_mtx_projection((void*)sIdentity);
+	n64_culling(false); /* there is no camera, count everything */
+	n64_stats(true);
+	
+	printf(
+		"%-32s %8s %6s %5s %5s %6s %8s %8s %5s %5s %5s %5s\n",
+		"file", "cmds", "dlists", "depth", "mtx", "vtxcmd", "vertices", "tris", "tex", "dup", "pal", "cc"
+	);
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (; i < argc; ++i, ++files) {
+		for (int k = 0; k < N64_SEGMENT_MAX; ++k)
+			n64_segment_set(k, segment[k]);
+		
+		if (dlstat(argv[i], seg, verbose))
+			rc = EXIT_FAILURE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	fprintf(
+		stderr, "%d files in %.3f s\n", files,
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9
+	);
+	
+	for (int k = 0; k < N64_SEGMENT_MAX; ++k)
+		free(segment[k]);
+	
+	return rc;
+}